@@ -1,63 +1,194 @@
 #include "cpu.h"
 
 #include "../mem/Bus.h"
+#include "interrupt.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
-#include <sstream>
-#include <iomanip>
+#include <type_traits>
 
 // #define printf(x, ...) 0
 
-std::string hextonum(uint16_t hex, int pad)
+// 1 for 16-bit registers, for the "+1 cycle if m=0/x=0" penalty
+template<typename T>
+constexpr int wide = sizeof(T) - 1;
+
+#ifdef SNES_TRACE
+void CPU::TraceOperand(uint8_t data)
 {
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0') << std::setw(pad) << hex;
-    std::string s = ss.str();
-    return s;
+    if (trace_rec && trace_operands < 3)
+        trace_rec->operands[trace_operands++] = data;
 }
+#endif
 
 uint8_t CPU::ReadImm8()
 {
-    uint8_t data = Bus::Read8(pbr << 16 | pc);
+    uint8_t data;
+    if (fetch)
+        data = *fetch++;
+    else
+    {
+        data = Bus::Read8(pbr << 16 | pc);
+        if (decoding)
+            decoding->operands[decoding->length++ - 1] = data;
+    }
     pc++;
+#ifdef SNES_TRACE
+    TraceOperand(data);
+#endif
     return data;
 }
 
 uint16_t CPU::ReadImm16()
 {
-    uint16_t data = Bus::Read16(pbr << 16 | pc);
+    uint16_t data;
+    if (fetch)
+    {
+        data = fetch[0] | (fetch[1] << 8);
+        fetch += 2;
+    }
+    else
+    {
+        data = Bus::Read16Bank(pbr << 16 | pc);
+        if (decoding)
+        {
+            decoding->operands[decoding->length++ - 1] = data & 0xff;
+            decoding->operands[decoding->length++ - 1] = data >> 8;
+        }
+    }
     pc += 2;
+#ifdef SNES_TRACE
+    TraceOperand(data & 0xff);
+    TraceOperand(data >> 8);
+#endif
     return data;
 }
 
-void CPU::SetAbs8(std::string &disasm, uint8_t data)
+uint32_t CPU::ReadImm24()
 {
-    uint16_t abs = Bus::Read16(pbr << 16 | pc);
-    pc += 2;
-    Bus::Write8(dbr << 16 | abs, data);
-    disasm = "$" + hextonum(abs, 4);
+    uint32_t data;
+    if (fetch)
+    {
+        data = fetch[0] | (fetch[1] << 8) | (fetch[2] << 16);
+        fetch += 3;
+    }
+    else
+    {
+        data = Bus::Read24Bank(pbr << 16 | pc);
+        if (decoding)
+        {
+            decoding->operands[decoding->length++ - 1] = data & 0xff;
+            decoding->operands[decoding->length++ - 1] = (data >> 8) & 0xff;
+            decoding->operands[decoding->length++ - 1] = data >> 16;
+        }
+    }
+    pc += 3;
+#ifdef SNES_TRACE
+    TraceOperand(data & 0xff);
+    TraceOperand((data >> 8) & 0xff);
+    TraceOperand(data >> 16);
+#endif
+    return data;
 }
 
-void CPU::SetAbs16(std::string &disasm, uint16_t data)
+template<typename T>
+T& CPU::Reg(Register& r)
 {
-    uint16_t abs = Bus::Read16(pbr << 16 | pc);
-    pc += 2;
-    Bus::Write16(dbr << 16 | abs, data);
-    disasm = "$" + hextonum(abs, 4);
+    if constexpr (sizeof(T) == 2)
+        return r.full;
+    else
+        return r.lo;
 }
 
-void CPU::SetFlag(Flags flag, bool set)
+template<typename T>
+T CPU::ReadImm()
+{
+    if constexpr (sizeof(T) == 2)
+        return ReadImm16();
+    else
+        return ReadImm8();
+}
+
+template<typename T>
+T CPU::Read(uint32_t addr)
+{
+    if constexpr (sizeof(T) == 2)
+        return Bus::Read16(addr);
+    else
+        return Bus::Read8(addr);
+}
+
+template<typename T>
+void CPU::Write(uint32_t addr, T data)
 {
-    if (set)
-        p |= flag;
+    writes++;
+    if constexpr (sizeof(T) == 2)
+        Bus::Write16(addr, data);
     else
-        p &= ~flag;
+        Bus::Write8(addr, data);
+}
+
+template<typename T>
+void CPU::SetNZ(T data)
+{
+    flag_z = data;
+    flag_n = data >> (sizeof(T) * 8 - 8);
+}
+
+void CPU::SetFlag(Flags flag, bool set)
+{
+    switch (flag)
+    {
+    case NF:
+        flag_n = set ? 0x80 : 0;
+        break;
+    case ZF:
+        flag_z = !set;
+        break;
+    case CF:
+        flag_c = set;
+        break;
+    case VF:
+        flag_v = set;
+        break;
+    default:
+        if (set)
+            p |= flag;
+        else
+            p &= ~flag;
+        break;
+    }
 }
 
 bool CPU::GetFlag(Flags flag)
 {
-    return p & flag;
+    switch (flag)
+    {
+    case NF:
+        return flag_n & 0x80;
+    case ZF:
+        return !flag_z;
+    case CF:
+        return flag_c;
+    case VF:
+        return flag_v;
+    default:
+        return p & flag;
+    }
+}
+
+uint8_t CPU::GetP()
+{
+    return p | (flag_n & NF) | (flag_v ? VF : 0) | (!flag_z ? ZF : 0) | (flag_c ? CF : 0);
+}
+
+void CPU::SetP(uint8_t data)
+{
+    p = data & (MF | XBF | DF | IF);
+    flag_n = data;
+    flag_z = !(data & ZF);
+    flag_c = data & CF;
+    flag_v = data & VF;
 }
 
 uint16_t CPU::GetDirXAddr()
@@ -72,6 +203,7 @@ uint16_t CPU::GetAbsXAddr()
 
 void CPU::Push8(uint8_t data)
 {
+    writes++;
     Bus::Write8(sp, data);
     sp--;
 }
@@ -82,6 +214,15 @@ void CPU::Push16(uint16_t data)
     Push8(data & 0xff);
 }
 
+template<typename T>
+void CPU::Push(T data)
+{
+    if constexpr (sizeof(T) == 2)
+        Push16(data);
+    else
+        Push8(data);
+}
+
 uint8_t CPU::Pop8()
 {
     sp++;
@@ -96,166 +237,366 @@ uint16_t CPU::Pop16()
     return (h << 8) | l;
 }
 
+template<typename T>
+T CPU::Pop()
+{
+    if constexpr (sizeof(T) == 2)
+        return Pop16();
+    else
+        return Pop8();
+}
+
+template<bool M, bool X>
+void CPU::BuildTable(CPUFunc* table)
+{
+    // Accumulator/memory and index register widths for this table
+    using MT = std::conditional_t<M, uint8_t, uint16_t>;
+    using XT = std::conditional_t<X, uint8_t, uint16_t>;
+
+    for (int i = 0; i < 256; i++)
+        table[i] = &CPU::UnknownOp;
+
+    table[0x04] = &CPU::TsbDir;
+    table[0x08] = &CPU::PhpImp;
+    table[0x09] = &CPU::OraImm<MT>;
+    table[0x0A] = &CPU::AslImp<MT>;
+    table[0x0B] = &CPU::PhdImp;
+    table[0x10] = &CPU::BplRel;
+    table[0x18] = &CPU::ClcImp;
+    table[0x1A] = &CPU::IncImp<MT>;
+    table[0x1B] = &CPU::TcsImp;
+    table[0x20] = &CPU::JsrAbs;
+    table[0x22] = &CPU::JslLng;
+    table[0x26] = &CPU::RolDir;
+    table[0x28] = &CPU::PlpImp;
+    table[0x29] = &CPU::AndImm<MT>;
+    table[0x2A] = &CPU::RolImp<MT>;
+    table[0x2B] = &CPU::PldImp;
+    table[0x2C] = &CPU::BitAbs<MT>;
+    table[0x30] = &CPU::BmiRel;
+    table[0x38] = &CPU::SecImp;
+    table[0x3A] = &CPU::DecAcc<MT>;
+    table[0x40] = &CPU::RtiImp;
+    table[0x48] = &CPU::PhaImp<MT>;
+    table[0x49] = &CPU::EorImm<MT>;
+    table[0x4A] = &CPU::LsrImp<MT>;
+    table[0x4B] = &CPU::PhkImp;
+    table[0x4C] = &CPU::JmpAbs;
+    table[0x58] = &CPU::CliImp;
+    table[0x5A] = &CPU::PhyImp<XT>;
+    table[0x5B] = &CPU::TcdImp;
+    table[0x5C] = &CPU::JmpLng;
+    table[0x60] = &CPU::RtsImp;
+    table[0x64] = &CPU::StzDir<MT>;
+    table[0x65] = &CPU::AdcDir<MT>;
+    table[0x67] = &CPU::AdcDrP<MT>;
+    table[0x68] = &CPU::PlaImp<MT>;
+    table[0x69] = &CPU::AdcImm<MT>; // Nice
+    table[0x6A] = &CPU::RorImp<MT>;
+    table[0x6B] = &CPU::RtlImp;
+    table[0x6C] = &CPU::JmpAbP;
+    table[0x74] = &CPU::StzDrx<MT>;
+    table[0x78] = &CPU::SeiImp;
+    table[0x7A] = &CPU::PlyImp<XT>;
+    table[0x7B] = &CPU::TdcImp;
+    table[0x80] = &CPU::BraRel;
+    table[0x84] = &CPU::StyDir<XT>;
+    table[0x85] = &CPU::StaDir<MT>;
+    table[0x86] = &CPU::StxDir<XT>;
+    table[0x88] = &CPU::DeyImp<XT>;
+    table[0x89] = &CPU::BitImm<MT>;
+    table[0x8A] = &CPU::TxaImp<MT>;
+    table[0x8B] = &CPU::PhbImp;
+    table[0x8C] = &CPU::StyAbs<XT>;
+    table[0x8D] = &CPU::StaAbs<MT>;
+    table[0x8E] = &CPU::StxAbs<XT>;
+    table[0x90] = &CPU::BccRel;
+    table[0x92] = &CPU::StaDrp<MT>;
+    table[0x98] = &CPU::TyaImp<MT>;
+    table[0x99] = &CPU::StaAbY<MT>;
+    table[0x9B] = &CPU::TxyImp<XT>;
+    table[0x9C] = &CPU::StzAbs<MT>;
+    table[0x9D] = &CPU::StaAbx<MT>;
+    table[0x9E] = &CPU::StzAbx<MT>;
+    table[0xA0] = &CPU::LdyImm<XT>;
+    table[0xA2] = &CPU::LdxImm<XT>;
+    table[0xA4] = &CPU::LdyDir<XT>;
+    table[0xA5] = &CPU::LdaDir<MT>;
+    table[0xA7] = &CPU::LdaDPL<MT>;
+    table[0xA8] = &CPU::TayImp<XT>;
+    table[0xA9] = &CPU::LdaImm<MT>;
+    table[0xAA] = &CPU::TaxImp<XT>;
+    table[0xAB] = &CPU::PlbImp;
+    table[0xAD] = &CPU::LdaAbs<MT>;
+    table[0xAE] = &CPU::LdxAbs<XT>;
+    table[0xB0] = &CPU::BcsRel;
+    table[0xB2] = &CPU::LdaDpt<MT>;
+    table[0xB7] = &CPU::LdaDPY<MT>;
+    table[0xBB] = &CPU::TyxImp<XT>;
+    table[0xBD] = &CPU::LdaAbx<MT>;
+    table[0xBF] = &CPU::LdaLnX<MT>;
+    table[0xC0] = &CPU::CpyImm<XT>;
+    table[0xC2] = &CPU::RepImm;
+    table[0xC4] = &CPU::CpyDir<XT>;
+    table[0xC6] = &CPU::DecDir<MT>;
+    table[0xC8] = &CPU::InyImp<XT>;
+    table[0xC9] = &CPU::CmpImm<MT>;
+    table[0xCA] = &CPU::DexImp<XT>;
+    table[0xCB] = &CPU::WaiImp;
+    table[0xCD] = &CPU::CmpAbs<MT>;
+    table[0xD0] = &CPU::BneRel;
+    table[0xD8] = &CPU::CldImp;
+    table[0xDA] = &CPU::PhxImp<XT>;
+    table[0xE0] = &CPU::CpxImm<XT>;
+    table[0xE2] = &CPU::SepImm;
+    table[0xE5] = &CPU::SbcDir<MT>;
+    table[0xE6] = &CPU::IncDir<MT>;
+    table[0xE8] = &CPU::InxImp<XT>;
+    table[0xE9] = &CPU::SbcImm<MT>;
+    table[0xEB] = &CPU::XbaImp;
+    table[0xF0] = &CPU::BeqRel;
+    table[0xF4] = &CPU::PeaImm;
+    table[0xFA] = &CPU::PlxImp<XT>;
+    table[0xFB] = &CPU::XceImp;
+    table[0xFC] = &CPU::JsrAbx;
+}
+
+// Must be called whenever M, X or E may have changed
+void CPU::UpdateMode()
+{
+    if (e)
+    {
+        SetFlag(MF, 1);
+        SetFlag(XBF, 1);
+    }
+
+    // 8-bit index registers always have a zero high byte
+    if (GetFlag(XBF))
+        x.hi = y.hi = 0;
+
+    mode = (GetFlag(MF) << 1) | GetFlag(XBF);
+    opcodes = tables[mode];
+}
+
 CPU::CPU()
 {
     pc = Bus::Read16(0xFFFC);
-    p = 0;
+    SetP(0);
     dbr = 0;
     sp = 0x1FF;
     pbr = 0;
+    d = 0;
     a.full = x.full = y.full = 0;
 
     SetFlag(MF, 1);
     SetFlag(XBF, 1);
 
-    opcodes[0x04] = std::bind(&CPU::TsbDir, this);
-    opcodes[0x08] = std::bind(&CPU::PhpImp, this);
-    opcodes[0x09] = std::bind(&CPU::OraImm, this);
-    opcodes[0x0A] = std::bind(&CPU::AslImp, this);
-    opcodes[0x0B] = std::bind(&CPU::PhdImp, this);
-    opcodes[0x10] = std::bind(&CPU::BplRel, this);
-    opcodes[0x18] = std::bind(&CPU::ClcImp, this);
-    opcodes[0x1A] = std::bind(&CPU::IncImp, this);
-    opcodes[0x1B] = std::bind(&CPU::TcsImp, this);
-    opcodes[0x20] = std::bind(&CPU::JsrAbs, this);
-    opcodes[0x22] = std::bind(&CPU::JslLng, this);
-    opcodes[0x26] = std::bind(&CPU::RolDir, this);
-    opcodes[0x28] = std::bind(&CPU::PlpImp, this);
-    opcodes[0x29] = std::bind(&CPU::AndImm, this);
-    opcodes[0x2A] = std::bind(&CPU::RolImp, this);
-    opcodes[0x2B] = std::bind(&CPU::PldImp, this);
-    opcodes[0x2C] = std::bind(&CPU::BitAbs, this);
-    opcodes[0x30] = std::bind(&CPU::BmiRel, this);
-    opcodes[0x38] = std::bind(&CPU::SecImp, this);
-    opcodes[0x3A] = std::bind(&CPU::DecAcc, this);
-    opcodes[0x40] = std::bind(&CPU::RtiImp, this);
-    opcodes[0x48] = std::bind(&CPU::PhaImp, this);
-    opcodes[0x49] = std::bind(&CPU::EorImm, this);
-    opcodes[0x4A] = std::bind(&CPU::LsrImp, this);
-    opcodes[0x4B] = std::bind(&CPU::PhkImp, this);
-    opcodes[0x4C] = std::bind(&CPU::JmpAbs, this);
-    opcodes[0x5A] = std::bind(&CPU::PhyImp, this);
-    opcodes[0x5B] = std::bind(&CPU::TcdImp, this);
-    opcodes[0x5C] = std::bind(&CPU::JmpLng, this);
-    opcodes[0x60] = std::bind(&CPU::RtsImp, this);
-    opcodes[0x64] = std::bind(&CPU::StzDir, this);
-    opcodes[0x65] = std::bind(&CPU::AdcDir, this);
-    opcodes[0x67] = std::bind(&CPU::AdcDrP, this);
-    opcodes[0x68] = std::bind(&CPU::PlaImp, this);
-    opcodes[0x69] = std::bind(&CPU::AdcImm, this); // Nice
-    opcodes[0x6A] = std::bind(&CPU::RorImp, this);
-    opcodes[0x6B] = std::bind(&CPU::RtlImp, this);
-    opcodes[0x6C] = std::bind(&CPU::JmpAbP, this);
-    opcodes[0x74] = std::bind(&CPU::StzDrx, this);
-    opcodes[0x78] = std::bind(&CPU::SeiImp, this);
-    opcodes[0x7A] = std::bind(&CPU::PlyImp, this);
-    opcodes[0x7B] = std::bind(&CPU::TdcImp, this);
-    opcodes[0x80] = std::bind(&CPU::BraRel, this);
-    opcodes[0x84] = std::bind(&CPU::StyDir, this);
-    opcodes[0x85] = std::bind(&CPU::StaDir, this);
-    opcodes[0x86] = std::bind(&CPU::StxDir, this);
-    opcodes[0x88] = std::bind(&CPU::DeyImp, this);
-    opcodes[0x89] = std::bind(&CPU::BitImm, this);
-    opcodes[0x8A] = std::bind(&CPU::TxaImp, this);
-    opcodes[0x8B] = std::bind(&CPU::PhbImp, this);
-    opcodes[0x8C] = std::bind(&CPU::StyAbs, this);
-    opcodes[0x8D] = std::bind(&CPU::StaAbs, this);
-    opcodes[0x8E] = std::bind(&CPU::StxAbs, this);
-    opcodes[0x90] = std::bind(&CPU::BccRel, this);
-    opcodes[0x92] = std::bind(&CPU::StaDrp, this);
-    opcodes[0x98] = std::bind(&CPU::TyaImp, this);
-    opcodes[0x99] = std::bind(&CPU::StaAbY, this);
-    opcodes[0x9B] = std::bind(&CPU::TxyImp, this);
-    opcodes[0x9C] = std::bind(&CPU::StzAbs, this);
-    opcodes[0x9D] = std::bind(&CPU::StaAbx, this);
-    opcodes[0x9E] = std::bind(&CPU::StzAbx, this);
-    opcodes[0xA0] = std::bind(&CPU::LdyImm, this);
-    opcodes[0xA2] = std::bind(&CPU::LdxImm, this);
-    opcodes[0xA4] = std::bind(&CPU::LdyDir, this);
-    opcodes[0xA5] = std::bind(&CPU::LdaDir, this);
-    opcodes[0xA7] = std::bind(&CPU::LdaDPL, this);
-    opcodes[0xA8] = std::bind(&CPU::TayImp, this);
-    opcodes[0xA9] = std::bind(&CPU::LdaImm, this);
-    opcodes[0xAA] = std::bind(&CPU::TaxImp, this);
-    opcodes[0xAB] = std::bind(&CPU::PlbImp, this);
-    opcodes[0xAD] = std::bind(&CPU::LdaAbs, this);
-    opcodes[0xAE] = std::bind(&CPU::LdxAbs, this);
-    opcodes[0xB0] = std::bind(&CPU::BcsRel, this);
-    opcodes[0xB2] = std::bind(&CPU::LdaDpt, this);
-    opcodes[0xB7] = std::bind(&CPU::LdaDPY, this);
-    opcodes[0xBB] = std::bind(&CPU::TyxImp, this);
-    opcodes[0xBD] = std::bind(&CPU::LdaAbx, this);
-    opcodes[0xBF] = std::bind(&CPU::LdaLnX, this);
-    opcodes[0xC0] = std::bind(&CPU::CpyImm, this);
-    opcodes[0xC2] = std::bind(&CPU::RepImm, this);
-    opcodes[0xC4] = std::bind(&CPU::CpyDir, this);
-    opcodes[0xC6] = std::bind(&CPU::DecDir, this);
-    opcodes[0xC8] = std::bind(&CPU::InyImp, this);
-    opcodes[0xC9] = std::bind(&CPU::CmpImm, this);
-    opcodes[0xCA] = std::bind(&CPU::DexImp, this);
-    opcodes[0xCD] = std::bind(&CPU::CmpAbs, this);
-    opcodes[0xD0] = std::bind(&CPU::BneRel, this);
-    opcodes[0xD8] = std::bind(&CPU::CldImp, this);
-    opcodes[0xDA] = std::bind(&CPU::PhxImp, this);
-    opcodes[0xE0] = std::bind(&CPU::CpxImm, this);
-    opcodes[0xE2] = std::bind(&CPU::SepImm, this);
-    opcodes[0xE5] = std::bind(&CPU::SbcDir, this);
-    opcodes[0xE6] = std::bind(&CPU::IncDir, this);
-    opcodes[0xE8] = std::bind(&CPU::InxImp, this);
-    opcodes[0xE9] = std::bind(&CPU::SbcImm, this);
-    opcodes[0xEB] = std::bind(&CPU::XbaImp, this);
-    opcodes[0xF0] = std::bind(&CPU::BeqRel, this);
-    opcodes[0xF4] = std::bind(&CPU::PeaImm, this);
-    opcodes[0xFA] = std::bind(&CPU::PlxImp, this);
-    opcodes[0xFB] = std::bind(&CPU::XceImp, this);
-    opcodes[0xFC] = std::bind(&CPU::JsrAbx, this);
+    BuildTable<false, false>(tables[0]);
+    BuildTable<false, true>(tables[1]);
+    BuildTable<true, false>(tables[2]);
+    BuildTable<true, true>(tables[3]);
+
+    decode_cache = new DecodedOp[DecodeCacheSize];
+    for (int i = 0; i < DecodeCacheSize; i++)
+        decode_cache[i].tag = ~0u;
+
+    UpdateMode();
+
+#ifdef SNES_JIT
+    InitJit();
+#endif
 
     printf("Reset vector is 0x%08x\n", pc);
 }
 
-void CPU::DoNMI()
+void CPU::DoInterrupt(uint16_t vector)
 {
     Push8(pbr);
     Push16(pc);
-    Push8(p);
+    Push8(GetP());
     SetFlag(IF, true);
     SetFlag(DF, false);
     pbr = 0;
-    pc = Bus::Read16(0xFFEA);
-    printf("[CPU]: DOING NMI\n");
+    pc = Bus::Read16(vector);
+#ifdef SNES_PROFILE
+    Profile::Call(pc, vector == 0xFFEA ? Profile::NMI : Profile::IRQ);
+#endif
+#ifdef SNES_JIT
+    block_start = true;
+#endif
+    idle_state.branch = ~0u;
+}
+
+int CPU::CheckInterrupts()
+{
+    // Any interrupt ends WAI, even an IRQ that I then masks
+    waiting = false;
+
+    if (Interrupt::pending & Interrupt::NMI)
+    {
+        Interrupt::TakeNMI();
+        DoInterrupt(0xFFEA);
+        return 8;
+    }
+
+    if (!GetFlag(IF))
+    {
+        DoInterrupt(0xFFEE);
+        return 8;
+    }
+
+    return 0;
+}
+
+void CPU::CheckIdle(uint16_t target)
+{
+    // Only short backward branches, pc is just past the two byte branch
+    uint16_t branch = pc - 2;
+    if ((uint16_t)(branch - target) > MaxIdleLoop)
+        return;
+
+    IdleState state = {(uint32_t)(pbr << 16 | branch), a.full, x.full, y.full, sp, d, GetP(), dbr, e};
+    uint32_t reads = Bus::SteppingReads();
+    idle = writes == idle_writes && reads == idle_reads && state == idle_state;
+
+    idle_state = state;
+    idle_writes = writes;
+    idle_reads = reads;
 }
 
 int CPU::Clock()
 {
-    printf("0x%06x ", pbr << 16 | pc);
+    idle = false;
+    ran = 1;
+
+    // Checked once per instruction or compiled block
+    if (Interrupt::pending)
+    {
+        int cycles = CheckInterrupts();
+        if (cycles)
+            return cycles;
+    }
+
+    // WAI, nothing to do until an interrupt wakes us up
+    if (waiting)
+        return 3;
+
+#ifdef SNES_JIT
+    if (block_start)
+    {
+        int cycles;
+        if (RunBlock(cycles))
+            return cycles;
+    }
+#endif
+
+#ifdef SNES_TRACE
+    if (Trace::Enabled())
+    {
+        trace_rec = Trace::Next();
+        trace_operands = 0;
+        trace_rec->pc = pbr << 16 | pc;
+        trace_rec->a = a.full;
+        trace_rec->x = x.full;
+        trace_rec->y = y.full;
+        trace_rec->s = sp;
+        trace_rec->d = d;
+        trace_rec->dbr = dbr;
+        trace_rec->p = GetP();
+        trace_rec->e = e;
+    }
+#endif
+
+    uint32_t addr = pbr << 16 | pc;
+    uint32_t tag = addr << 2 | mode;
+    DecodedOp& op = decode_cache[DecodeIndex(addr)];
+    uint8_t opcode;
+    int cycles;
+
+    if (op.tag == tag)
+    {
+        // Predecoded ROM instruction, operands come from the cache entry
+        opcode = op.opcode;
+#ifdef SNES_TRACE
+        if (trace_rec)
+            trace_rec->opcode = opcode;
+#endif
+        pc++;
+        fetch = op.operands;
+        cycles = (this->*op.func)();
+        fetch = nullptr;
+
+        if (op.fast && Bus::FastROM())
+            cycles -= FastFetch(op.length);
+    }
+    else
+    {
+        opcode = Bus::Read8(addr);
+        pc++;
+
+#ifdef SNES_TRACE
+        if (trace_rec)
+            trace_rec->opcode = opcode;
+#endif
+
+        // ROM never changes, so remember how this instruction decoded. The
+        // whole instruction has to be in ROM, not just the opcode.
+        if (Bus::IsRom(addr) && Bus::IsRom(pbr << 16 | (uint16_t)(pc + 2)))
+        {
+            decoding = &op;
+            op.tag = ~0u;
+            op.func = opcodes[opcode];
+            op.opcode = opcode;
+            op.length = 1;
+            op.fast = Bus::IsFastRegion(addr);
+        }
 
-    uint8_t opcode = Bus::Read8(pbr << 16 | pc++);
+        cycles = (this->*opcodes[opcode])();
 
-    static char buf[4096];
+        if (decoding)
+        {
+            op.tag = tag;
+            decoding = nullptr;
 
-    snprintf(buf, 4096, "\t\t\tA:%04x X:%04x Y:%04x S:%04x D:%04x DB:%02x %s%s%s%s%s%s%s%s ", a.full, x.full, y.full, sp, d, dbr,
-            GetFlag(NF) ? "N" : "n",
-            GetFlag(VF) ? "V" : "v",
-            GetFlag(MF) ? "M" : "m",
-            GetFlag(XBF) ? "X" : "x",
-            GetFlag(DF) ? "D" : "d",
-            GetFlag(IF) ? "I" : "i",
-            GetFlag(ZF) ? "Z" : "z",
-            GetFlag(CF) ? "C" : "c");
+            if (op.fast && Bus::FastROM())
+                cycles -= FastFetch(op.length);
+        }
+    }
 
-    if (!opcodes[opcode])
+#ifdef SNES_TRACE
+    if (trace_rec)
     {
-        printf("Unknown opcode 0x%02x\n", opcode);
-        exit(1);
+        trace_rec->cycles = cycles;
+        trace_rec = nullptr;
     }
+#endif
+
+#ifdef SNES_PROFILE
+    Profile::Instruction(addr, cycles);
+#endif
 
-    int cycles = opcodes[opcode]();
+#ifdef SNES_JIT
+    block_start = EndsBlock(opcode);
+#endif
 
-    printf("%s\n", buf);
-    
     return cycles;
 }
 
+int CPU::FastFetch(int bytes)
+{
+    fast_clocks += 2 * bytes;
+    int saved = fast_clocks / 8;
+    fast_clocks %= 8;
+    return saved;
+}
+
+int CPU::UnknownOp()
+{
+    uint8_t opcode = Bus::Read8(pbr << 16 | (uint16_t)(pc-1));
+    printf("Unknown opcode 0x%02x\n", opcode);
+    exit(1);
+}
+
 #undef printf
 
 void CPU::Dump()
@@ -268,84 +609,52 @@ void CPU::Dump()
     printf("dbr\t->\t0x%02x\n", dbr);
     printf("pbr\t->\t0x%02x\n", pbr);
     printf("d\t->\t0x%04x\n", d);
-    printf("[%s%s%s%s%s]\n", 
-        e ? "e" : ".", 
-        GetFlag(MF) ? "m" : ".", 
-        GetFlag(XBF) ? "x" : ".", 
-        GetFlag(NF) ? "n" : ".", 
+    printf("[%s%s%s%s%s]\n",
+        e ? "e" : ".",
+        GetFlag(MF) ? "m" : ".",
+        GetFlag(XBF) ? "x" : ".",
+        GetFlag(NF) ? "n" : ".",
         GetFlag(ZF) ? "z" : ".");
 }
 
-// #define printf(x, ...) 0
-
 int CPU::TsbDir()
 {
     uint16_t addr = d + ReadImm8();
     uint8_t data = Bus::Read8(addr);
     SetFlag(ZF, !(data & a.lo));
     data |= a.lo;
-    Bus::Write8(addr, data);
-    printf("tsb $%02x   ", addr-d);
+    Write<uint8_t>(addr, data);
     return 5;
 }
 
 int CPU::PhpImp()
 {
-    Push8(p);
-    printf("php     ");
+    Push8(GetP());
     return 3;
 }
 
+template<typename T>
 int CPU::OraImm()
 {
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = ReadImm16();
-        a.full |= imm;
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("ora #$%04x ", imm);
-        return 3;
-    }
-    else
-    {
-        uint8_t imm = ReadImm8();
-        a.lo |= imm;
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("ora #$%02x ", imm);
-        return 2;
-    }
+    T imm = ReadImm<T>();
+    Reg<T>(a) |= imm;
+    SetNZ<T>(Reg<T>(a));
+    return 2 + wide<T>;
 }
 
+template<typename T>
 int CPU::AslImp()
 {
-    if (!GetFlag(MF))
-    {
-        uint32_t result = a.full << 1;
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, result > 0xFFFF);
-        a.full = result;
-        printf("asl     ");
-        return 2;
-    }
-    else
-    {
-        uint16_t result = a.lo << 1;
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, result > 0xFF);
-        a.lo = result;
-        printf("asl     ");
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    SetFlag(CF, (acc >> (sizeof(T) * 8 - 1)) & 1);
+    acc <<= 1;
+    SetNZ<T>(acc);
+    return 2;
 }
 
 int CPU::PhdImp()
 {
     Push16(d);
-    printf("phd     ");
     return 5;
 }
 
@@ -358,14 +667,10 @@ int CPU::BplRel()
         uint16_t new_pc = pc + rel;
         if ((new_pc & 0xff00) != (pc & 0xff00))
             cycles++;
-        printf("bpl $%06x (t) ", pbr << 16 | new_pc);
+        CheckIdle(new_pc);
         pc = new_pc;
         cycles++;
     }
-    else
-    {
-        printf("bpl $%06x (n) ", pbr << 16 | (pc+rel));
-    }
 
     return cycles;
 }
@@ -374,37 +679,21 @@ int CPU::ClcImp()
 {
     SetFlag(CF, false);
 
-    printf("clc     ");
-
     return 2;
 }
 
+template<typename T>
 int CPU::IncImp()
 {
-    if (!GetFlag(MF))
-    {
-        uint16_t result = a.full + 1;
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        a.full = result;
-        printf("inc     ");
-        return 2;
-    }
-    else
-    {
-        uint8_t result = a.lo + 1;
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        a.lo = result;
-        printf("inc     ");
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    acc++;
+    SetNZ<T>(acc);
+    return 2;
 }
 
 int CPU::TcsImp()
 {
     sp = a.full;
-    printf("tcs     ");
     return 2;
 }
 
@@ -413,7 +702,9 @@ int CPU::JsrAbs()
     uint16_t new_pc = ReadImm16();
     Push16(pc-1);
     pc = new_pc;
-    printf("jsr $%04x ", new_pc);
+#ifdef SNES_PROFILE
+    Profile::Call(pbr << 16 | pc, Profile::Sub);
+#endif
     return 6;
 }
 
@@ -422,12 +713,15 @@ int CPU::JslLng()
     Push8(pbr);
     Push16(pc+2);
 
-    uint16_t new_pc = ReadImm16();
-    pbr = ReadImm8();
+    uint32_t target = ReadImm24();
+    uint16_t new_pc = target;
+    pbr = target >> 16;
 
     pc = new_pc;
+#ifdef SNES_PROFILE
+    Profile::Call(pbr << 16 | pc, Profile::Sub);
+#endif
 
-    printf("jsl $%06x ", pbr << 16 | pc);
     return 8;
 }
 
@@ -440,93 +734,48 @@ int CPU::RolDir()
     data = (data << 1) | old_carry;
     SetFlag(NF, (data >> 7) & 1);
     SetFlag(ZF, !data);
-    Bus::Write8(addr, data);
-    printf("rol $%02x   ", addr-d);
+    Write<uint8_t>(addr, data);
     return 5;
 }
 
 int CPU::PlpImp()
 {
-    p = Pop8();
-    if (e)
-    {
-        SetFlag(MF, 1);
-        SetFlag(XBF, 1);
-    }
-    printf("plp     ");
+    SetP(Pop8());
+    UpdateMode();
     return 4;
 }
 
+template<typename T>
 int CPU::PlaImp()
 {
-    if (!GetFlag(MF))
-    {
-        a.full = Pop16();
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("pla     ");
-        return 5;
-    }
-    else
-    {
-        a.lo = Pop8();
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("pla     ");
-        return 4;
-    }
+    T& acc = Reg<T>(a);
+    acc = Pop<T>();
+    SetNZ<T>(acc);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::AdcImm()
 {
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = ReadImm16();
-        uint32_t result = a.full + imm + GetFlag(CF);
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(VF, ((a.full ^ result) & (imm ^ result) & 0x8000) != 0);
-        SetFlag(CF, result > 0xFFFF);
-        a.full = result;
-        printf("adc #$%04x ", imm);
-        return 3;
-    }
-    else
-    {
-        uint8_t imm = ReadImm8();
-        uint16_t result = a.lo + imm + GetFlag(CF);
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(VF, ((a.lo ^ result) & (imm ^ result) & 0x80) != 0);
-        SetFlag(CF, result > 0xFF);
-        a.lo = result;
-        printf("adc #$%02x ", imm);
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    T imm = ReadImm<T>();
+    uint32_t result = acc + imm + GetFlag(CF);
+    SetNZ<T>(result);
+    SetFlag(VF, ((acc ^ result) & (imm ^ result) & (1 << (sizeof(T) * 8 - 1))) != 0);
+    SetFlag(CF, result > (T)~0);
+    acc = result;
+    return 2 + wide<T>;
 }
 
+template<typename T>
 int CPU::RorImp()
 {
-    if (!GetFlag(MF))
-    {
-        bool old_cf = GetFlag(CF);
-        SetFlag(CF, a.full & 1);
-        a.full = (a.full >> 1) | (old_cf << 15);
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("ror     ");
-        return 2;
-    }
-    else
-    {
-        bool old_cf = GetFlag(CF);
-        SetFlag(CF, a.lo & 1);
-        a.lo = (a.lo >> 1) | (old_cf << 7);
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("ror     ");
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    bool old_cf = GetFlag(CF);
+    SetFlag(CF, acc & 1);
+    acc = (acc >> 1) | (old_cf << (sizeof(T) * 8 - 1));
+    SetNZ<T>(acc);
+    return 2;
 }
 
 int CPU::RtlImp()
@@ -534,67 +783,52 @@ int CPU::RtlImp()
     uint16_t new_pc = Pop16();
     pbr = Pop8();
     pc = new_pc + 1;
+#ifdef SNES_PROFILE
+    Profile::Return();
+#endif
 
-    printf("rtl     ");
     return 6;
 }
 
 int CPU::JmpAbP()
 {
     uint16_t ptr_addr = ReadImm16();
-    uint16_t new_pc = Bus::Read16(ptr_addr);
+    uint16_t new_pc = Bus::Read16Bank(ptr_addr);
 
     pc = new_pc;
 
-    printf("jmp ($%04x) ", ptr_addr);
     return 5;
 }
 
+template<typename T>
 int CPU::StzDrx()
 {
     uint16_t addr = GetDirXAddr();
+    Write<T>(addr, 0);
+    return 4 + wide<T>;
+}
 
-    if (!GetFlag(MF))
-    {
-        Bus::Write16(addr, 0);
-        printf("stz $%02x,x ", addr-d-x.lo);
-        return 5;
-    }
-    else
-    {
-        Bus::Write8(addr, 0);
-        printf("stz $%02x,x ", addr-d-x.lo);
-        return 4;
-    }
+int CPU::CliImp()
+{
+    SetFlag(IF, false);
+
+    return 2;
 }
 
 int CPU::SeiImp()
 {
     SetFlag(IF, true);
 
-    printf("sei     ");
-
     return 2;
 }
 
+template<typename T>
 int CPU::PlyImp()
 {
-    if (!GetFlag(MF))
-    {
-        y.full = Pop16();
-        SetFlag(NF, (y.full >> 15) & 1);
-        SetFlag(ZF, !y.full);
-        printf("ply     ");
-        return 5;
-    }
-    else
-    {
-        y.lo = Pop8();
-        SetFlag(NF, (y.lo >> 7) & 1);
-        SetFlag(ZF, !y.lo);
-        printf("ply     ");
-        return 4;
-    }
+    T& idx = Reg<T>(y);
+    idx = Pop<T>();
+    SetNZ<T>(idx);
+    return 4 + wide<T>;
 }
 
 int CPU::TdcImp()
@@ -603,8 +837,6 @@ int CPU::TdcImp()
     SetFlag(NF, (d >> 15) & 1);
     SetFlag(ZF, !d);
 
-    printf("tdc     ");
-
     return 2;
 }
 
@@ -616,215 +848,107 @@ int CPU::BraRel()
     uint16_t new_pc = pc + rel;
     if ((new_pc & 0xff00) != (pc & 0xff00))
         cycles++;
-    printf("bra $%06x (t) ", pbr << 16 | new_pc);
+    CheckIdle(new_pc);
     pc = new_pc;
     cycles++;
 
     return cycles;
 }
 
+template<typename T>
 int CPU::LdaDir()
 {
     uint16_t addr = d + ReadImm8();
-
-    if (!GetFlag(MF))
-    {
-        a.full = Bus::Read16(addr);
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("lda $%02x   ", addr-d);
-        return 5;
-    }
-    else
-    {
-        a.lo = Bus::Read8(addr);
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("lda $%02x   ", addr-d);
-        return 4;
-    }
+    T& acc = Reg<T>(a);
+    acc = Read<T>(addr);
+    SetNZ<T>(acc);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::LdaDPL()
 {
     uint16_t ptr_addr = d + ReadImm8();
-    uint32_t addr = Bus::Read16(ptr_addr);
-    addr |= (uint32_t)Bus::Read8(ptr_addr+2) << 16;
+    uint32_t addr = Bus::Read24Bank(ptr_addr);
 
-    if (!GetFlag(MF))
-    {
-        a.full = Bus::Read16(addr);
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("lda [$%02x] ", ptr_addr-d);
-        return 6;
-    }
-    else
-    {
-        a.lo = Bus::Read8(addr);
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("lda [$%02x] ", ptr_addr-d);
-        return 5;
-    }
+    T& acc = Reg<T>(a);
+    acc = Read<T>(addr);
+    SetNZ<T>(acc);
+    return 5 + wide<T>;
 }
 
+template<typename T>
 int CPU::TayImp()
 {
-    if (!GetFlag(MF))
-    {
-        y.full = a.full;
-        SetFlag(NF, (y.full >> 15) & 1);
-        SetFlag(ZF, !y.full);
-        printf("tay     ");
-        return 2;
-    }
-    else
-    {
-        y.lo = a.lo;
-        SetFlag(NF, (y.lo >> 7) & 1);
-        SetFlag(ZF, !y.lo);
-        printf("tay     ");
-        return 2;
-    }
+    T& idx = Reg<T>(y);
+    idx = Reg<T>(a);
+    SetNZ<T>(idx);
+    return 2;
 }
 
+template<typename T>
 int CPU::LdaImm()
 {
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = ReadImm16();
-        a.full = imm;
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("lda #$%04x ", imm);
-        return 3;
-    }
-    else
-    {
-        uint8_t imm = ReadImm8();
-        a.lo = imm;
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("lda #$%02x ", imm);
-        return 2;
-    }
+    T imm = ReadImm<T>();
+    Reg<T>(a) = imm;
+    SetNZ<T>(imm);
+    return 2 + wide<T>;
 }
 
+template<typename T>
 int CPU::TaxImp()
 {
-    if (!GetFlag(MF))
-    {
-        x.full = a.full;
-        SetFlag(NF, (x.full >> 15) & 1);
-        SetFlag(ZF, !x.full);
-        printf("tax     ");
-        return 2;
-    }
-    else
-    {
-        x.lo = a.lo;
-        SetFlag(NF, (x.lo >> 7) & 1);
-        SetFlag(ZF, !x.lo);
-        printf("tax     ");
-        return 2;
-    }
+    T& idx = Reg<T>(x);
+    idx = Reg<T>(a);
+    SetNZ<T>(idx);
+    return 2;
 }
 
 int CPU::PlbImp()
 {
     dbr = Pop8();
-    printf("plb     ");
     return 4;
 }
 
+template<typename T>
 int CPU::LdaAbs()
 {
     uint16_t addr = ReadImm16();
-    if (!GetFlag(MF))
-    {
-        a.full = Bus::Read16(dbr << 16 | addr);
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("lda $%04x ", addr);
-        return 4;
-    }
-    else
-    {
-        a.lo = Bus::Read8(dbr << 16 | addr);
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("lda $%04x ", addr);
-        return 3;
-    }
+    T& acc = Reg<T>(a);
+    acc = Read<T>(dbr << 16 | addr);
+    SetNZ<T>(acc);
+    return 3 + wide<T>;
 }
 
+template<typename T>
 int CPU::LdxAbs()
 {
     uint16_t addr = ReadImm16();
-    if (!GetFlag(XBF))
-    {
-        x.full = Bus::Read16(dbr << 16 | addr);
-        SetFlag(NF, (x.full >> 15) & 1);
-        SetFlag(ZF, !x.full);
-        printf("ldx $%04x ", addr);
-        return 4;
-    }
-    else
-    {
-        x.full = Bus::Read8(dbr << 16 | addr);
-        SetFlag(NF, (x.lo >> 7) & 1);
-        SetFlag(ZF, !x.lo);
-        printf("ldx $%04x ", addr);
-        return 3;
-    }
+    T& idx = Reg<T>(x);
+    idx = Read<T>(dbr << 16 | addr);
+    SetNZ<T>(idx);
+    return 3 + wide<T>;
 }
 
+template<typename T>
 int CPU::LdaLnX()
 {
-    uint32_t addr = ReadImm16();
-    addr |= (uint32_t)ReadImm8() << 16;
+    uint32_t addr = ReadImm24();
 
-    if (!GetFlag(MF))
-    {
-        a.full = Bus::Read16(addr + x.full);
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("lda $%06x,x ", addr);
-        return 5;
-    }
-    else
-    {
-        a.lo = Bus::Read8(addr + x.full);
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("lda $%06x,x ", addr);
-        return 4;
-    }
+    T& acc = Reg<T>(a);
+    acc = Read<T>(addr + x.full);
+    SetNZ<T>(acc);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::CpyImm()
 {
-    if (!GetFlag(XBF))
-    {
-        uint16_t imm = ReadImm16();
-        uint16_t result = y.full - imm;
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, y.full >= imm);
-        printf("cpy #$%04x ", imm);
-        return 3;
-    }
-    else
-    {
-        uint8_t imm = ReadImm8();
-        uint8_t result = y.lo - imm;
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, y.lo >= imm);
-        printf("cpy #$%02x ", imm);
-        return 2;
-    }
+    T& idx = Reg<T>(y);
+    T imm = ReadImm<T>();
+    SetNZ<T>(idx - imm);
+    SetFlag(CF, idx >= imm);
+    return 2 + wide<T>;
 }
 
 int CPU::RepImm()
@@ -835,146 +959,75 @@ int CPU::RepImm()
         if (imm & (1 << i))
             SetFlag((Flags)(1 << i), false);
     }
-    printf("rep #$%x ", imm);
-    return 3; 
+    UpdateMode();
+    return 3;
 }
 
+template<typename T>
 int CPU::CpyDir()
 {
     uint16_t addr = d + ReadImm8();
-    if (!GetFlag(MF))
-    {
-        uint16_t data = Bus::Read16(addr);
-        uint16_t result = y.full - data;
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, y.full >= data);
-        printf("cpy $%02x   ", addr-d);
-        return 5;
-    }
-    else
-    {
-        uint8_t data = Bus::Read8(addr);
-        uint8_t result = y.lo - data;
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, y.lo >= data);
-        printf("cpy $%02x   ", addr-d);
-        return 4;
-    }
+    T& idx = Reg<T>(y);
+    T data = Read<T>(addr);
+    SetNZ<T>(idx - data);
+    SetFlag(CF, idx >= data);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::DecDir()
 {
     uint16_t addr = d + ReadImm8();
-
-    if (!GetFlag(MF))
-    {
-        uint16_t result = Bus::Read16(addr) - 1;
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        Bus::Write16(addr, result);
-        printf("dec $%02x   ", addr-d);
-        return 5;
-    }
-    else
-    {
-        uint8_t result = Bus::Read8(addr) - 1;
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        Bus::Write8(addr, result);
-        printf("dec $%02x   ", addr-d);
-        return 4;
-    }
+    T result = Read<T>(addr) - 1;
+    SetNZ<T>(result);
+    Write<T>(addr, result);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::InyImp()
 {
-    if (!GetFlag(MF))
-    {
-        y.full++;
-        SetFlag(NF, (y.full >> 15) & 1);
-        SetFlag(ZF, !y.full);
-        printf("iny     ");
-        return 2;
-    }
-    else
-    {
-        y.lo++;
-        SetFlag(NF, (y.lo >> 7) & 1);
-        SetFlag(ZF, !y.lo);
-        printf("iny     ");
-        return 2;
-    }
+    T& idx = Reg<T>(y);
+    idx++;
+    SetNZ<T>(idx);
+    return 2;
 }
 
+template<typename T>
 int CPU::CmpImm()
 {
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = ReadImm16();
-        uint16_t result = a.full - imm;
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, a.full < imm);
-        printf("cmp #$%04x ", imm);
-        return 3;
-    }
-    else
-    {
-        uint8_t imm = ReadImm8();
-        uint8_t result = a.lo - imm;
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, a.lo < imm);
-        printf("cmp #$%02x ", imm);
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    T imm = ReadImm<T>();
+    SetNZ<T>(acc - imm);
+    SetFlag(CF, acc >= imm);
+    return 2 + wide<T>;
 }
 
+template<typename T>
 int CPU::DexImp()
 {
-    if (!GetFlag(XBF))
-    {
-        x.full--;
-        SetFlag(NF, (x.full >> 15) & 1);
-        SetFlag(ZF, !x.full);
-        printf("dex     ");
-        return 2;
-    }
-    else
-    {
-        x.lo--;
-        SetFlag(NF, (x.lo >> 7) & 1);
-        SetFlag(ZF, !x.lo);
-        printf("dex     ");
-        return 2;
-    }
+    T& idx = Reg<T>(x);
+    idx--;
+    SetNZ<T>(idx);
+    return 2;
+}
+
+int CPU::WaiImp()
+{
+    // Clock stops running instructions until an NMI or IRQ is pending
+    waiting = true;
+    return 3;
 }
 
+template<typename T>
 int CPU::CmpAbs()
 {
     uint16_t addr = ReadImm16();
-    if (!GetFlag(MF))
-    {
-        uint16_t data = Bus::Read16(dbr << 16 | addr);
-        uint16_t result = a.full - data;
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, a.full < data);
-        printf("cmp $%04x ", addr);
-        return 5;
-    }
-    else
-    {
-        uint8_t data = Bus::Read8(dbr << 16 | addr);
-        uint8_t result = a.lo - data;
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, a.lo < data);
-        printf("cmp $%04x ", addr);
-        return 4;
-    }
+    T& acc = Reg<T>(a);
+    T data = Read<T>(dbr << 16 | addr);
+    SetNZ<T>(acc - data);
+    SetFlag(CF, acc >= data);
+    return 4 + wide<T>;
 }
 
 int CPU::BneRel()
@@ -986,14 +1039,10 @@ int CPU::BneRel()
         uint16_t new_pc = pc + rel;
         if ((new_pc & 0xff00) != (pc & 0xff00))
             cycles++;
-        printf("bne $%06x (t) ", pbr << 16 | new_pc);
+        CheckIdle(new_pc);
         pc = new_pc;
         cycles++;
     }
-    else
-    {
-        printf("bne $%06x (n) ", pbr << 16 | (pc+rel));
-    }
 
     return cycles;
 }
@@ -1001,48 +1050,24 @@ int CPU::BneRel()
 int CPU::CldImp()
 {
     SetFlag(DF, false);
-    printf("cld     ");
     return 2;
 }
 
+template<typename T>
 int CPU::PhxImp()
 {
-    if (!GetFlag(XBF))
-    {
-        Push16(x.full);
-        printf("phx     ");
-        return 4;
-    }
-    else
-    {
-        Push8(x.lo);
-        printf("phx     ");
-        return 3;
-    }
+    Push<T>(Reg<T>(x));
+    return 3 + wide<T>;
 }
 
+template<typename T>
 int CPU::CpxImm()
 {
-    if (!GetFlag(XBF))
-    {
-        uint16_t imm = ReadImm16();
-        uint16_t result = x.full - imm;
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, x.full >= imm);
-        printf("cpx #$%04x ", imm);
-        return 3;
-    }
-    else
-    {
-        uint8_t imm = ReadImm8();
-        uint8_t result = x.lo - imm;
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(CF, x.lo >= imm);
-        printf("cpx #$%02x ", imm);
-        return 2;
-    }
+    T& idx = Reg<T>(x);
+    T imm = ReadImm<T>();
+    SetNZ<T>(idx - imm);
+    SetFlag(CF, idx >= imm);
+    return 2 + wide<T>;
 }
 
 int CPU::SepImm()
@@ -1053,110 +1078,54 @@ int CPU::SepImm()
         if (imm & (1 << i))
             SetFlag((Flags)(1 << i), true);
     }
-    printf("sep #$%x ", imm);
+    UpdateMode();
     return 3;
 }
 
+template<typename T>
 int CPU::SbcDir()
 {
     uint16_t addr = d + ReadImm8();
-
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = Bus::Read16(addr);
-        uint32_t result = a.full - imm - 1 + GetFlag(CF);
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(VF, ((a.full ^ result) & (a.full ^ imm) & 0x8000) != 0);
-        SetFlag(CF, result > 0xFFFF);
-        a.full = result;
-        printf("sbc $%02x   ", addr-d);
-        return 5;
-    }
-    else
-    {
-        uint8_t imm = Bus::Read8(addr);
-        uint16_t result = a.lo - imm - 1 + GetFlag(CF);
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(VF, ((a.lo ^ result) & (a.lo ^ imm) & 0x80) != 0);
-        SetFlag(CF, result > 0xFF);
-        a.lo = result;
-        printf("sbc $%02x   ", addr-d);
-        return 4;
-    }
+    T& acc = Reg<T>(a);
+    T imm = Read<T>(addr);
+    uint32_t result = acc - imm - 1 + GetFlag(CF);
+    SetNZ<T>(result);
+    SetFlag(VF, ((acc ^ result) & (acc ^ imm) & (1 << (sizeof(T) * 8 - 1))) != 0);
+    SetFlag(CF, result <= (T)~0);
+    acc = result;
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::IncDir()
 {
     uint16_t addr = d + ReadImm8();
-
-    if (!GetFlag(MF))
-    {
-        uint16_t result = Bus::Read16(addr) + 1;
-        Bus::Write16(addr, result);
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        printf("inc $%02x   ", addr-d);
-        return 5;
-    }
-    else
-    {
-        uint8_t result = Bus::Read8(addr) + 1;
-        Bus::Write8(addr, result);
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        printf("inc $%02x   ", addr-d);
-        return 4;
-    }
+    T result = Read<T>(addr) + 1;
+    Write<T>(addr, result);
+    SetNZ<T>(result);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::InxImp()
 {
-    if (!GetFlag(XBF))
-    {
-        x.full++;
-        SetFlag(NF, (x.full >> 15) & 1);
-        SetFlag(ZF, !x.full);
-        printf("inx     ");
-        return 2;
-    }
-    else
-    {
-        x.lo++;
-        SetFlag(NF, (x.lo >> 7) & 1);
-        SetFlag(ZF, !x.lo);
-        printf("inx     ");
-        return 2;
-    }
+    T& idx = Reg<T>(x);
+    idx++;
+    SetNZ<T>(idx);
+    return 2;
 }
 
+template<typename T>
 int CPU::SbcImm()
 {
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = ReadImm16();
-        uint32_t result = a.full - imm - 1 + GetFlag(CF);
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(VF, ((a.full ^ result) & (a.full ^ imm) & 0x8000) != 0);
-        SetFlag(CF, result <= 0xFFFF);
-        a.full = result;
-        printf("sbc #$%04x ", imm);
-        return 3;
-    }
-    else
-    {
-        uint8_t imm = ReadImm8();
-        uint16_t result = a.lo - imm - 1 + GetFlag(CF);
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(VF, ((a.lo ^ result) & (a.lo ^ imm) & 0x80) != 0);
-        SetFlag(CF, result <= 0xFF);
-        a.lo = result;
-        printf("sbc #$%02x ", imm);
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    T imm = ReadImm<T>();
+    uint32_t result = acc - imm - 1 + GetFlag(CF);
+    SetNZ<T>(result);
+    SetFlag(VF, ((acc ^ result) & (acc ^ imm) & (1 << (sizeof(T) * 8 - 1))) != 0);
+    SetFlag(CF, result <= (T)~0);
+    acc = result;
+    return 2 + wide<T>;
 }
 
 int CPU::XbaImp()
@@ -1166,7 +1135,6 @@ int CPU::XbaImp()
     a.hi = temp;
     SetFlag(NF, (a.lo >> 7) & 1);
     SetFlag(ZF, !a.lo);
-    printf("xba     ");
     return 3;
 }
 
@@ -1179,14 +1147,10 @@ int CPU::BeqRel()
         uint16_t new_pc = pc + rel;
         if ((new_pc & 0xff00) != (pc & 0xff00))
             cycles++;
-        printf("beq $%06x (t) ", pbr << 16 | new_pc);
+        CheckIdle(new_pc);
         pc = new_pc;
         cycles++;
     }
-    else
-    {
-        printf("beq $%06x (n) ", pbr << 16 | (pc+rel));
-    }
 
     return cycles;
 }
@@ -1195,28 +1159,16 @@ int CPU::PeaImm()
 {
     uint16_t imm = ReadImm16();
     Push16(imm);
-    printf("pea #$%04x ", imm);
     return 5;
 }
 
+template<typename T>
 int CPU::PlxImp()
 {
-    if (!GetFlag(XBF))
-    {
-        x.full = Pop16();
-        SetFlag(NF, (x.full >> 15) & 1);
-        SetFlag(ZF, !x.full);
-        printf("plx     ");
-        return 5;
-    }
-    else
-    {
-        x.lo = Pop8();
-        SetFlag(NF, (x.lo >> 7) & 1);
-        SetFlag(ZF, !x.lo);
-        printf("plx     ");
-        return 4;
-    }
+    T& idx = Reg<T>(x);
+    idx = Pop<T>();
+    SetNZ<T>(idx);
+    return 4 + wide<T>;
 }
 
 int CPU::XceImp()
@@ -1224,8 +1176,8 @@ int CPU::XceImp()
     bool temp = GetFlag(CF);
     SetFlag(CF, e);
     e = temp;
+    UpdateMode();
 
-    printf("xce     ");
     assert(!e);
     return 2;
 }
@@ -1233,114 +1185,63 @@ int CPU::XceImp()
 int CPU::JsrAbx()
 {
     uint16_t addr = ReadImm16() + x.full;
-    uint16_t new_pc = Bus::Read16(pbr << 16 | addr);
+    uint16_t new_pc = Bus::Read16Bank(pbr << 16 | addr);
 
     Push16(pc-1);
 
     pc = new_pc;
+#ifdef SNES_PROFILE
+    Profile::Call(pbr << 16 | pc, Profile::Sub);
+#endif
 
-    printf("jsr ($%04x,x) ", addr);
     return 8;
 }
 
+template<typename T>
 int CPU::BitImm()
 {
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = ReadImm16();
-        uint16_t result = a.full & imm;
-        SetFlag(ZF, result == 0);
-        printf("bit #$%04x ", imm);
-        return 3;
-    }
-    else
-    {
-        uint8_t imm = ReadImm8();
-        uint8_t result = a.lo & imm;
-        SetFlag(ZF, result == 0);
-        printf("bit #$%02x ", imm);
-        return 2;
-    }
+    T imm = ReadImm<T>();
+    SetFlag(ZF, (Reg<T>(a) & imm) == 0);
+    return 2 + wide<T>;
 }
 
+template<typename T>
 int CPU::TxaImp()
 {
-    if (!GetFlag(MF))
-    {
-        a.full = x.full;
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("txa     ");
-        return 2;
-    }
-    else
-    {
-        a.lo = x.lo;
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("txa     ");
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    acc = Reg<T>(x);
+    SetNZ<T>(acc);
+    return 2;
 }
 
 int CPU::PhbImp()
 {
     Push8(dbr);
-    printf("phb     ");
     return 3;
 }
 
+template<typename T>
 int CPU::StyAbs()
 {
     uint16_t addr = ReadImm16();
-    if (!GetFlag(XBF))
-    {
-        Bus::Write16(dbr << 16 | addr, y.full);
-        printf("sty $%04x ", addr);
-        return 4;
-    }
-    else
-    {
-        Bus::Write8(dbr << 16 | addr, y.lo);
-        printf("sty $%04x ", addr);
-        return 3;
-    }
+    Write<T>(dbr << 16 | addr, Reg<T>(y));
+    return 3 + wide<T>;
 }
 
+template<typename T>
 int CPU::StaAbs()
 {
-    std::string disasm;
-    int cycles;
-    if (!GetFlag(MF))
-    {
-        SetAbs16(disasm, a.full);
-        cycles = 5;
-    }
-    else
-    {
-        SetAbs8(disasm, a.lo);
-        cycles = 4;
-    }
-    printf("sta %s ", disasm.c_str());
-    return cycles;
+    uint16_t addr = ReadImm16();
+    Write<T>(dbr << 16 | addr, Reg<T>(a));
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::StxAbs()
 {
-    std::string disasm;
-    int cycles;
-    if (!GetFlag(XBF))
-    {
-        SetAbs16(disasm, x.full);
-        cycles = 5;
-    }
-    else
-    {
-        SetAbs8(disasm, x.lo);
-        cycles = 4;
-    }
-    printf("stx %s ", disasm.c_str());
-    return cycles;
+    uint16_t addr = ReadImm16();
+    Write<T>(dbr << 16 | addr, Reg<T>(x));
+    return 4 + wide<T>;
 }
 
 int CPU::BccRel()
@@ -1352,88 +1253,46 @@ int CPU::BccRel()
         uint16_t new_pc = pc + rel;
         if ((new_pc & 0xff00) != (pc & 0xff00))
             cycles++;
-        printf("bcc $%06x (t) ", pbr << 16 | new_pc);
+        CheckIdle(new_pc);
         pc = new_pc;
         cycles++;
     }
-    else
-    {
-        printf("bcc $%06x (n) ", pbr << 16 | (pc+rel));
-    }
 
     return cycles;
 }
 
+template<typename T>
 int CPU::StaDrp()
 {
-    uint8_t ptr_addr = d + ReadImm8();
-    uint16_t addr = Bus::Read16(ptr_addr);
+    uint16_t ptr_addr = d + ReadImm8();
+    uint16_t addr = Bus::Read16Bank(ptr_addr);
 
-    if (!GetFlag(MF))
-    {
-        Bus::Write16(dbr << 16 | addr, a.full);
-        printf("sta [$%02x] ", ptr_addr-d);
-        return 6;
-    }
-    else
-    {
-        Bus::Write8(dbr << 16 | addr, a.lo);
-        printf("sta [$%02x] ", ptr_addr-d);
-        return 5;
-    }
+    Write<T>(dbr << 16 | addr, Reg<T>(a));
+    return 5 + wide<T>;
 }
 
+template<typename T>
 int CPU::TyaImp()
 {
-    if (!GetFlag(MF))
-    {
-        a.full = y.full;
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("tya     ");
-        return 2;
-    }
-    else
-    {
-        a.lo = y.lo;
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("tya     ");
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    acc = Reg<T>(y);
+    SetNZ<T>(acc);
+    return 2;
 }
 
+template<typename T>
 int CPU::StaAbY()
 {
     uint16_t addr = ReadImm16() + y.full;
-    if (!GetFlag(MF))
-    {
-        Bus::Write16(dbr << 16 | addr, a.full);
-        printf("sta $%04x,y ", addr-y.full);
-        return 5;
-    }
-    else
-    {
-        Bus::Write8(dbr << 16 | addr, a.lo);
-        printf("sta $%04x,y ", addr-y.full);
-        return 4;
-    }
+    Write<T>(dbr << 16 | addr, Reg<T>(a));
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::PhyImp()
 {
-    if (!GetFlag(XBF))
-    {
-        Push16(y.full);
-        printf("phy     ");
-        return 4;
-    }
-    else
-    {
-        Push8(y.lo);
-        printf("phy     ");
-        return 3;
-    }
+    Push<T>(Reg<T>(y));
+    return 3 + wide<T>;
 }
 
 int CPU::TcdImp()
@@ -1443,180 +1302,107 @@ int CPU::TcdImp()
     SetFlag(NF, (d >> 15) & 1);
     SetFlag(ZF, !d);
 
-    printf("tcd     ");
     return 2;
 }
 
 int CPU::JmpLng()
 {
-    uint16_t new_pc = ReadImm16();
-    pbr = ReadImm8();
+    uint32_t target = ReadImm24();
+    uint16_t new_pc = target;
+    pbr = target >> 16;
     pc = new_pc;
 
-    printf("jmp $%06x ", pbr << 16 | pc);
     return 4;
 }
 
 int CPU::RtsImp()
 {
     pc = Pop16() + 1;
-    printf("rts     ");
+#ifdef SNES_PROFILE
+    Profile::Return();
+#endif
     return 6;
 }
 
+template<typename T>
 int CPU::StzDir()
 {
     uint16_t addr = d + ReadImm8();
-
-    if (!GetFlag(MF))
-    {
-        Bus::Write16(addr, 0);
-        printf("stz $%02x   ", addr-d);
-        return 5;
-    }
-    else
-    {
-        Bus::Write8(addr, 0);
-        printf("stz $%02x   ", addr-d);
-        return 4;
-    }
+    Write<T>(addr, 0);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::AdcDir()
 {
     uint16_t addr = d + ReadImm8();
-
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = Bus::Read16(addr);
-        uint32_t result = a.full + imm + GetFlag(CF);
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(VF, ((a.full ^ result) & (imm ^ result) & 0x8000) != 0);
-        SetFlag(CF, result > 0xFFFF);
-        a.full = result;
-        printf("adc $%02x   ", addr-d);
-        return 5;
-    }
-    else
-    {
-        uint8_t imm = Bus::Read8(addr);
-        uint16_t result = a.lo + imm + GetFlag(CF);
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(VF, ((a.lo ^ result) & (imm ^ result) & 0x80) != 0);
-        SetFlag(CF, result > 0xFF);
-        a.lo = result;
-        printf("adc $%02x   ", addr-d);
-        return 4;
-    }
+    T& acc = Reg<T>(a);
+    T imm = Read<T>(addr);
+    uint32_t result = acc + imm + GetFlag(CF);
+    SetNZ<T>(result);
+    SetFlag(VF, ((acc ^ result) & (imm ^ result) & (1 << (sizeof(T) * 8 - 1))) != 0);
+    SetFlag(CF, result > (T)~0);
+    acc = result;
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::AdcDrP()
 {
-    uint8_t ptr_addr = d + ReadImm8();
-    uint32_t addr = Bus::Read16(ptr_addr);
-    addr |= (uint32_t)Bus::Read8(ptr_addr+2) << 16;
+    uint16_t ptr_addr = d + ReadImm8();
+    uint32_t addr = Bus::Read24Bank(ptr_addr);
 
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = Bus::Read16(addr);
-        uint32_t result = a.full + imm + GetFlag(CF);
-        SetFlag(NF, (result >> 15) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(VF, ((a.full ^ result) & (imm ^ result) & 0x8000) != 0);
-        SetFlag(CF, result > 0xFFFF);
-        a.full = result;
-        printf("adc [$%02x] ", ptr_addr-d);
-        return 6;
-    }
-    else
-    {
-        uint8_t imm = Bus::Read8(addr);
-        uint16_t result = a.lo + imm + GetFlag(CF);
-        SetFlag(NF, (result >> 7) & 1);
-        SetFlag(ZF, !result);
-        SetFlag(VF, ((a.lo ^ result) & (imm ^ result) & 0x80) != 0);
-        SetFlag(CF, result > 0xFF);
-        a.lo = result;
-        printf("adc [$%02x] ", ptr_addr-d);
-        return 5;
-    }
+    T& acc = Reg<T>(a);
+    T imm = Read<T>(addr);
+    uint32_t result = acc + imm + GetFlag(CF);
+    SetNZ<T>(result);
+    SetFlag(VF, ((acc ^ result) & (imm ^ result) & (1 << (sizeof(T) * 8 - 1))) != 0);
+    SetFlag(CF, result > (T)~0);
+    acc = result;
+    return 5 + wide<T>;
 }
 
 int CPU::RtiImp()
 {
-    p = Pop8();
+    SetP(Pop8());
     pc = Pop16();
     pbr = Pop8();
-    printf("rti     ");
+    UpdateMode();
+#ifdef SNES_PROFILE
+    Profile::Return();
+#endif
     return 6;
 }
 
+template<typename T>
 int CPU::PhaImp()
 {
-    if (!GetFlag(MF))
-    {
-        Push16(a.full);
-        printf("pha     ");
-        return 4;
-    }
-    else
-    {
-        Push8(a.lo);
-        printf("pha     ");
-        return 3;
-    }
+    Push<T>(Reg<T>(a));
+    return 3 + wide<T>;
 }
 
+template<typename T>
 int CPU::EorImm()
 {
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = ReadImm16();
-        a.full ^= imm;
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("eor #$%04x ", imm);
-        return 3;
-    }
-    else
-    {
-        uint8_t imm = ReadImm8();
-        a.lo ^= imm;
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("eor #$%02x ", imm);
-        return 2;
-    }
+    T imm = ReadImm<T>();
+    Reg<T>(a) ^= imm;
+    SetNZ<T>(Reg<T>(a));
+    return 2 + wide<T>;
 }
 
+template<typename T>
 int CPU::LsrImp()
 {
-    if (!GetFlag(MF))
-    {
-        SetFlag(CF, a.full & 1);
-        a.full >>= 1;
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("lsr     ");
-        return 2;
-    }
-    else
-    {
-        SetFlag(CF, a.lo & 1);
-        a.lo >>= 1;
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("lsr     ");
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    SetFlag(CF, acc & 1);
+    acc >>= 1;
+    SetNZ<T>(acc);
+    return 2;
 }
 
 int CPU::PhkImp()
 {
     Push8(pbr);
-    printf("phk     ");
     return 3;
 }
 
@@ -1624,190 +1410,89 @@ int CPU::JmpAbs()
 {
     uint16_t addr = ReadImm16();
     pc = addr;
-    printf("jmp $%04x ", addr);
     return 3;
 }
 
+template<typename T>
 int CPU::TxyImp()
 {
-    if (!GetFlag(XBF))
-    {
-        y.full = x.full;
-        SetFlag(NF, (y.full >> 15) & 1);
-        SetFlag(ZF, !y.full);
-        printf("txy     ");
-        return 2;
-    }
-    else
-    {
-        y.lo = x.lo;
-        SetFlag(NF, (y.lo >> 7) & 1);
-        SetFlag(ZF, !y.lo);
-        printf("txy     ");
-        return 2;
-    }
+    T& idx = Reg<T>(y);
+    idx = Reg<T>(x);
+    SetNZ<T>(idx);
+    return 2;
 }
 
+template<typename T>
 int CPU::StzAbs()
 {
-    std::string disasm;
-    int cycles;
-    if (!GetFlag(MF))
-    {
-        SetAbs16(disasm, 0);
-        cycles = 5;
-    }
-    else
-    {
-        SetAbs8(disasm, 0);
-        cycles = 4;
-    }
-    printf("stz %s ", disasm.c_str());
-    return cycles;
+    uint16_t addr = ReadImm16();
+    Write<T>(dbr << 16 | addr, 0);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::StaAbx()
 {
     uint16_t addr = ReadImm16() + x.full;
-    if (!GetFlag(MF))
-    {
-        Bus::Write16(dbr << 16 | addr, a.full);
-        printf("sta $%04x,x ", addr-x.full);
-        return 5;
-    }
-    else
-    {
-        Bus::Write8(dbr << 16 | addr, a.lo);
-        printf("sta $%04x,x ", addr-x.full);
-        return 4;
-    }
+    Write<T>(dbr << 16 | addr, Reg<T>(a));
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::StzAbx()
 {
     uint16_t addr = GetAbsXAddr();
-    if (!GetFlag(MF))
-    {
-        Bus::Write16(addr, 0);
-        printf("stz $%04x,x ", (addr&0xFFFF)-x.full);
-        return 5;
-    }
-    else
-    {
-        Bus::Write8(addr, 0);
-        printf("stz $%04x,x ", (addr&0xFFFF)-x.full);
-        return 4;
-    }
+    Write<T>(addr, 0);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::LdyImm()
 {
-    if (!GetFlag(XBF))
-    {
-        y.full = ReadImm16();
-        SetFlag(NF, (y.full >> 15) & 1);
-        SetFlag(ZF, !y.full);
-        printf("ldy #$%04x ", y.full);
-        return 3;
-    }
-    else
-    {
-        y.full = ReadImm8();
-        SetFlag(NF, (y.lo >> 7) & 1);
-        SetFlag(ZF, !y.lo);
-        printf("ldy #$%02x ", y.lo);
-        return 2;
-    }
+    T& idx = Reg<T>(y);
+    idx = ReadImm<T>();
+    SetNZ<T>(idx);
+    return 2 + wide<T>;
 }
 
+template<typename T>
 int CPU::LdxImm()
 {
-    if (!GetFlag(XBF))
-    {
-        x.full = ReadImm16();
-        SetFlag(NF, (x.full >> 15) & 1);
-        SetFlag(ZF, !x.full);
-        printf("ldx #$%04x ", x.full);
-        return 3;
-    }
-    else
-    {
-        x.full = ReadImm8();
-        SetFlag(NF, (x.lo >> 7) & 1);
-        SetFlag(ZF, !x.lo);
-        printf("ldx #$%02x ", x.lo);
-        return 2;
-    }
+    T& idx = Reg<T>(x);
+    idx = ReadImm<T>();
+    SetNZ<T>(idx);
+    return 2 + wide<T>;
 }
 
+template<typename T>
 int CPU::LdyDir()
 {
     uint16_t addr = d + ReadImm8();
-
-    if (!GetFlag(XBF))
-    {
-        y.full = Bus::Read16(addr);
-        SetFlag(NF, (y.full >> 15) & 1);
-        SetFlag(ZF, !y.full);
-        printf("ldy $%02x   ", addr-d);
-        return 5;
-    }
-    else
-    {
-        y.lo = Bus::Read8(addr);
-        SetFlag(NF, (y.lo >> 7) & 1);
-        SetFlag(ZF, !y.lo);
-        printf("ldy $%02x   ", addr-d);
-        return 4;
-    }
+    T& idx = Reg<T>(y);
+    idx = Read<T>(addr);
+    SetNZ<T>(idx);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::AndImm()
 {
-    if (!GetFlag(MF))
-    {
-        uint16_t imm = ReadImm16();
-        a.full &= imm;
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("and #$%04x ", imm);
-        return 3;
-    }
-    else
-    {
-        uint8_t imm = ReadImm8();
-        a.lo &= imm;
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("and #$%02x ", imm);
-        return 2;
-    }
+    T imm = ReadImm<T>();
+    Reg<T>(a) &= imm;
+    SetNZ<T>(Reg<T>(a));
+    return 2 + wide<T>;
 }
 
+template<typename T>
 int CPU::RolImp()
 {
-    if (!GetFlag(MF))
-    {
-        uint16_t temp = a.full;
-        a.full <<= 1;
-        a.full |= GetFlag(CF);
-        SetFlag(CF, (temp >> 15) & 1);
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("rol     ");
-        return 2;
-    }
-    else
-    {
-        uint8_t temp = a.lo;
-        a.lo <<= 1;
-        a.lo |= GetFlag(CF);
-        SetFlag(CF, (temp >> 7) & 1);
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("rol     ");
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    T temp = acc;
+    acc <<= 1;
+    acc |= GetFlag(CF);
+    SetFlag(CF, (temp >> (sizeof(T) * 8 - 1)) & 1);
+    SetNZ<T>(acc);
+    return 2;
 }
 
 int CPU::PldImp()
@@ -1815,31 +1500,18 @@ int CPU::PldImp()
     d = Pop16();
     SetFlag(NF, (d >> 15) & 1);
     SetFlag(ZF, !d);
-    printf("pld     ");
     return 5;
 }
 
+template<typename T>
 int CPU::BitAbs()
 {
     uint16_t abs = ReadImm16();
-    if (!GetFlag(MF))
-    {
-        uint16_t data = Bus::Read16(dbr << 16 | abs);
-        SetFlag(NF, (data >> 15) & 1);
-        SetFlag(VF, (data >> 14) & 1);
-        SetFlag(ZF, !(data & a.full));
-        printf("bit $%04x ", abs);
-        return 5;
-    }
-    else
-    {
-        uint8_t data = Bus::Read8(dbr << 16 | abs);
-        SetFlag(NF, (data >> 7) & 1);
-        SetFlag(VF, (data >> 6) & 1);
-        SetFlag(ZF, !(data & a.lo));
-        printf("bit $%04x ", abs);
-        return 4;
-    }
+    T data = Read<T>(dbr << 16 | abs);
+    SetFlag(NF, (data >> (sizeof(T) * 8 - 1)) & 1);
+    SetFlag(VF, (data >> (sizeof(T) * 8 - 2)) & 1);
+    SetFlag(ZF, !(data & Reg<T>(a)));
+    return 4 + wide<T>;
 }
 
 int CPU::BmiRel()
@@ -1851,14 +1523,10 @@ int CPU::BmiRel()
         uint16_t new_pc = pc + rel;
         if ((new_pc & 0xff00) != (pc & 0xff00))
             cycles++;
-        printf("bmi $%06x (t) ", pbr << 16 | new_pc);
+        CheckIdle(new_pc);
         pc = new_pc;
         cycles++;
     }
-    else
-    {
-        printf("bmi $%06x (n) ", pbr << 16 | (pc+rel));
-    }
 
     return cycles;
 }
@@ -1866,28 +1534,16 @@ int CPU::BmiRel()
 int CPU::SecImp()
 {
     SetFlag(CF, true);
-    printf("sec     ");
     return 2;
 }
 
+template<typename T>
 int CPU::DecAcc()
 {
-    if (!GetFlag(MF))
-    {
-        a.full--;
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("dec     ");
-        return 2;
-    }
-    else
-    {
-        a.lo--;
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("dec     ");
-        return 2;
-    }
+    T& acc = Reg<T>(a);
+    acc--;
+    SetNZ<T>(acc);
+    return 2;
 }
 
 int CPU::BcsRel()
@@ -1899,175 +1555,88 @@ int CPU::BcsRel()
         uint16_t new_pc = pc + rel;
         if ((new_pc & 0xff00) != (pc & 0xff00))
             cycles++;
-        printf("bcs $%06x (t) ", pbr << 16 | new_pc);
+        CheckIdle(new_pc);
         pc = new_pc;
         cycles++;
     }
-    else
-    {
-        printf("bcs $%06x (n) ", pbr << 16 | (pc+rel));
-    }
 
     return cycles;
 }
 
+template<typename T>
 int CPU::LdaDpt()
 {
     uint16_t ptr_addr = ReadImm8() + d;
-    uint32_t addr = dbr << 16 | Bus::Read16(ptr_addr);
+    uint32_t addr = dbr << 16 | Bus::Read16Bank(ptr_addr);
 
-    if (!GetFlag(MF))
-    {
-        a.full = Bus::Read16(addr);
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("lda ($%02x) ", ptr_addr-d);
-        return 6;
-    }
-    else
-    {
-        a.lo = Bus::Read8(addr);
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("lda ($%02x) ", ptr_addr-d);
-        return 5;
-    }
+    T& acc = Reg<T>(a);
+    acc = Read<T>(addr);
+    SetNZ<T>(acc);
+    return 5 + wide<T>;
 }
 
 // [dir],y
+template<typename T>
 int CPU::LdaDPY()
 {
     uint16_t ptr_addr = ReadImm8() + d;
-    uint32_t addr = Bus::Read16(ptr_addr);
-    addr |= (uint32_t)Bus::Read8(ptr_addr+2) << 16;
+    uint32_t addr = Bus::Read24Bank(ptr_addr);
     addr += y.full;
 
-    if (!GetFlag(MF))
-    {
-        a.full = Bus::Read16(addr);
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("lda [$%02x],y ", ptr_addr-d);
-        return 6;
-    }
-    else
-    {
-        a.lo = Bus::Read8(addr);
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("lda [$%02x],y ", ptr_addr-d);
-        return 5;
-    }
+    T& acc = Reg<T>(a);
+    acc = Read<T>(addr);
+    SetNZ<T>(acc);
+    return 5 + wide<T>;
 }
 
+template<typename T>
 int CPU::TyxImp()
 {
-    if (!GetFlag(XBF))
-    {
-        x.full = y.full;
-        SetFlag(NF, (x.full >> 15) & 1);
-        SetFlag(ZF, !x.full);
-        printf("tyx     ");
-        return 2;
-    }
-    else
-    {
-        x.lo = y.lo;
-        SetFlag(NF, (x.lo >> 7) & 1);
-        SetFlag(ZF, !x.lo);
-        printf("tyx     ");
-        return 2;
-    }
+    T& idx = Reg<T>(x);
+    idx = Reg<T>(y);
+    SetNZ<T>(idx);
+    return 2;
 }
 
+template<typename T>
 int CPU::LdaAbx()
 {
     uint16_t addr = ReadImm16() + x.full;
-    if (!GetFlag(MF))
-    {
-        a.full = Bus::Read16(dbr << 16 | addr);
-        SetFlag(NF, (a.full >> 15) & 1);
-        SetFlag(ZF, !a.full);
-        printf("lda $%04x,x ", addr-x.full);
-        return 5;
-    }
-    else
-    {
-        a.lo = Bus::Read8(dbr << 16 | addr);
-        SetFlag(NF, (a.lo >> 7) & 1);
-        SetFlag(ZF, !a.lo);
-        printf("lda $%04x,x ", addr-x.full);
-        return 4;
-    }
+    T& acc = Reg<T>(a);
+    acc = Read<T>(dbr << 16 | addr);
+    SetNZ<T>(acc);
+    return 4 + wide<T>;
 }
 
+template<typename T>
 int CPU::StyDir()
 {
     uint16_t addr = d + ReadImm8();
-    if (!GetFlag(XBF))
-    {
-        Bus::Write16(addr, y.full);
-        printf("sty $%02x ", addr-d);
-        return 4;
-    }
-    else
-    {
-        Bus::Write8(addr, y.lo);
-        printf("sty $%02x ", addr-d);
-        return 3;
-    }
+    Write<T>(addr, Reg<T>(y));
+    return 3 + wide<T>;
 }
 
+template<typename T>
 int CPU::StaDir()
 {
     uint16_t addr = d + ReadImm8();
-    if (!GetFlag(MF))
-    {
-        Bus::Write16(addr, a.full);
-        printf("sta $%02x ", addr-d);
-        return 4;
-    }
-    else
-    {
-        Bus::Write8(addr, a.lo);
-        printf("sta $%02x ", addr-d);
-        return 3;
-    }
+    Write<T>(addr, Reg<T>(a));
+    return 3 + wide<T>;
 }
 
+template<typename T>
 int CPU::StxDir()
 {
     uint16_t addr = d + ReadImm8();
-    if (!GetFlag(XBF))
-    {
-        Bus::Write16(addr, x.full);
-        printf("stx $%02x ", addr-d);
-        return 4;
-    }
-    else
-    {
-        Bus::Write8(addr, x.lo);
-        printf("stx $%02x ", addr-d);
-        return 3;
-    }
+    Write<T>(addr, Reg<T>(x));
+    return 3 + wide<T>;
 }
 
+template<typename T>
 int CPU::DeyImp()
 {
-    if (!GetFlag(XBF))
-    {
-        y.full--;
-        SetFlag(NF, (y.full >> 15) & 1);
-        SetFlag(ZF, !y.full);
-        printf("dey     ");
-        return 2;
-    }
-    else
-    {
-        y.lo--;
-        SetFlag(NF, (y.lo >> 7) & 1);
-        SetFlag(ZF, !y.lo);
-        printf("dey     ");
-        return 2;
-    }
+    T& idx = Reg<T>(y);
+    idx--;
+    SetNZ<T>(idx);
+    return 2;
 }
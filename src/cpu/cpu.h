@@ -1,9 +1,9 @@
 #pragma once
 
 #include <cstdint>
-#include <functional>
-#include <unordered_map>
-#include <string>
+
+#include "profile.h"
+#include "trace.h"
 
 union Register
 {
@@ -21,7 +21,16 @@ private:
     uint16_t pc;
     uint16_t sp;
     Register a, x, y;
-    uint8_t p;
+    uint8_t p;      // Only M, X, D and I, see GetP for the rest
+
+    // Nearly every ALU op sets N and Z and the next one overwrites them
+    // before anything looks, so they're kept as the last result and only
+    // turned into bits when GetFlag or GetP asks. N is bit 7 of flag_n and
+    // Z is set while flag_z is zero. C and V are stored unpacked.
+    uint8_t flag_n;
+    uint16_t flag_z;
+    bool flag_c;
+    bool flag_v;
 
     uint8_t dbr;
     uint8_t pbr;
@@ -42,138 +51,261 @@ private:
 
     uint8_t ReadImm8();
     uint16_t ReadImm16();
+    uint32_t ReadImm24();
 
-    void SetAbs8(std::string& disasm, uint8_t data);
-    void SetAbs16(std::string& disasm, uint16_t data);
+    // Width-generic accessors, T is uint8_t or uint16_t depending on M/X
+    template<typename T> T& Reg(Register& r);
+    template<typename T> T ReadImm();
+    template<typename T> T Read(uint32_t addr);
+    template<typename T> void Write(uint32_t addr, T data);
+    template<typename T> void SetNZ(T data);
 
     void SetFlag(Flags flag, bool set);
     bool GetFlag(Flags flag);
 
+    // The status register as the 65816 sees it, for PHP, PLP, RTI and interrupts
+    uint8_t GetP();
+    void SetP(uint8_t data);
+
     uint16_t GetDirXAddr();
     uint16_t GetAbsXAddr();
 
     int TsbDir(); // 0x04
     int PhpImp(); // 0x08
-    int OraImm(); // 0x09
-    int AslImp(); // 0x0A
+    template<typename T> int OraImm(); // 0x09
+    template<typename T> int AslImp(); // 0x0A
     int PhdImp(); // 0x0B
     int BplRel(); // 0x10
     int ClcImp(); // 0x18
-    int IncImp(); // 0x1A
+    template<typename T> int IncImp(); // 0x1A
     int TcsImp(); // 0x1B
     int TrbAbs(); // 0x1C
     int JsrAbs(); // 0x20
     int JslLng(); // 0x22
     int RolDir(); // 0x26
     int PlpImp(); // 0x28
-    int AndImm(); // 0x29
-    int RolImp(); // 0x2A
+    template<typename T> int AndImm(); // 0x29
+    template<typename T> int RolImp(); // 0x2A
     int PldImp(); // 0x2B
-    int BitAbs(); // 0x2C
+    template<typename T> int BitAbs(); // 0x2C
     int BmiRel(); // 0x30
     int SecImp(); // 0x38
-    int DecAcc(); // 0x3A
-    int AndLnX(); // 0x3F
+    template<typename T> int DecAcc(); // 0x3A
     int RtiImp(); // 0x40
-    int PhaImp(); // 0x48
-    int EorImm(); // 0x49
-    int LsrImp(); // 0x4A
+    template<typename T> int PhaImp(); // 0x48
+    template<typename T> int EorImm(); // 0x49
+    template<typename T> int LsrImp(); // 0x4A
     int PhkImp(); // 0x4B
     int JmpAbs(); // 0x4C
-    int PhyImp(); // 0x5A
+    int CliImp(); // 0x58
+    template<typename T> int PhyImp(); // 0x5A
     int TcdImp(); // 0x5B
     int JmpLng(); // 0x5C
     int RtsImp(); // 0x60
-    int StzDir(); // 0x64
-    int AdcDir(); // 0x65
-    int AdcDrP(); // 0x67
-    int PlaImp(); // 0x68
-    int AdcImm(); // 0x69
-    int RorImp(); // 0x6A
+    template<typename T> int StzDir(); // 0x64
+    template<typename T> int AdcDir(); // 0x65
+    template<typename T> int AdcDrP(); // 0x67
+    template<typename T> int PlaImp(); // 0x68
+    template<typename T> int AdcImm(); // 0x69
+    template<typename T> int RorImp(); // 0x6A
     int RtlImp(); // 0x6B
     int JmpAbP(); // 0x6C
-    int StzDrx(); // 0x74
+    template<typename T> int StzDrx(); // 0x74
     int SeiImp(); // 0x78
-    int PlyImp(); // 0x7A
+    template<typename T> int PlyImp(); // 0x7A
     int TdcImp(); // 0x7B
     int BraRel(); // 0x80
-    int StyDir(); // 0x84
-    int StaDir(); // 0x85
-    int StxDir(); // 0x86
-    int DeyImp(); // 0x88
-    int BitImm(); // 0x89
-    int TxaImp(); // 0x8A
+    template<typename T> int StyDir(); // 0x84
+    template<typename T> int StaDir(); // 0x85
+    template<typename T> int StxDir(); // 0x86
+    template<typename T> int DeyImp(); // 0x88
+    template<typename T> int BitImm(); // 0x89
+    template<typename T> int TxaImp(); // 0x8A
     int PhbImp(); // 0x8B
-    int StyAbs(); // 0x8C
-    int StaAbs(); // 0x8D
-    int StxAbs(); // 0x8E
+    template<typename T> int StyAbs(); // 0x8C
+    template<typename T> int StaAbs(); // 0x8D
+    template<typename T> int StxAbs(); // 0x8E
     int BccRel(); // 0x90
-    int StaDrp(); // 0x92
-    int TyaImp(); // 0x98
-    int StaAbY(); // 0x99
-    int TxsImp(); // 0x9A
-    int TxyImp(); // 0x9B
-    int StzAbs(); // 0x9C
-    int StaAbx(); // 0x9D
-    int StzAbx(); // 0x9E
-    int LdyImm(); // 0xA0
-    int LdxImm(); // 0xA2
-    int LdyDir(); // 0xA4
-    int LdaDir(); // 0xA5
-    int LdaDPL(); // 0xA7 (Direct pointer long (aka [dir]))
-    int TayImp(); // 0xA8
-    int LdaImm(); // 0xA9
-    int TaxImp(); // 0xAA
+    template<typename T> int StaDrp(); // 0x92
+    template<typename T> int TyaImp(); // 0x98
+    template<typename T> int StaAbY(); // 0x99
+    template<typename T> int TxyImp(); // 0x9B
+    template<typename T> int StzAbs(); // 0x9C
+    template<typename T> int StaAbx(); // 0x9D
+    template<typename T> int StzAbx(); // 0x9E
+    template<typename T> int LdyImm(); // 0xA0
+    template<typename T> int LdxImm(); // 0xA2
+    template<typename T> int LdyDir(); // 0xA4
+    template<typename T> int LdaDir(); // 0xA5
+    template<typename T> int LdaDPL(); // 0xA7 (Direct pointer long (aka [dir]))
+    template<typename T> int TayImp(); // 0xA8
+    template<typename T> int LdaImm(); // 0xA9
+    template<typename T> int TaxImp(); // 0xAA
     int PlbImp(); // 0xAB
-    int LdaAbs(); // 0xAD
-    int LdxAbs(); // 0xAE
+    template<typename T> int LdaAbs(); // 0xAD
+    template<typename T> int LdxAbs(); // 0xAE
     int BcsRel(); // 0xB0
-    int LdaDpt(); // 0xB2
-    int LdaDPY(); // 0xB7 [dir],y
-    int TyxImp(); // 0xBB
-    int LdaAbx(); // 0xBD
-    int LdaLnX(); // 0xBF
-    int CpyImm(); // 0xC0
+    template<typename T> int LdaDpt(); // 0xB2
+    template<typename T> int LdaDPY(); // 0xB7 [dir],y
+    template<typename T> int TyxImp(); // 0xBB
+    template<typename T> int LdaAbx(); // 0xBD
+    template<typename T> int LdaLnX(); // 0xBF
+    template<typename T> int CpyImm(); // 0xC0
     int RepImm(); // 0xC2
-    int CpyDir(); // 0xC4
-    int CmpDir(); // 0xC5
-    int DecDir(); // 0xC6
-    int InyImp(); // 0xC8
-    int CmpImm(); // 0xC9
-    int DexImp(); // 0xCA
-    int CmpAbs(); // 0xCD
+    template<typename T> int CpyDir(); // 0xC4
+    template<typename T> int DecDir(); // 0xC6
+    template<typename T> int InyImp(); // 0xC8
+    template<typename T> int CmpImm(); // 0xC9
+    template<typename T> int DexImp(); // 0xCA
+    int WaiImp(); // 0xCB
+    template<typename T> int CmpAbs(); // 0xCD
     int BneRel(); // 0xD0
     int CldImp(); // 0xD8
-    int PhxImp(); // 0xDA
-    int CpxImm(); // 0xE0
+    template<typename T> int PhxImp(); // 0xDA
+    template<typename T> int CpxImm(); // 0xE0
     int SepImm(); // 0xE2
-    int SbcDir(); // 0xE5
-    int IncDir(); // 0xE6
-    int InxImp(); // 0xE8
-    int SbcImm(); // 0xE9
+    template<typename T> int SbcDir(); // 0xE5
+    template<typename T> int IncDir(); // 0xE6
+    template<typename T> int InxImp(); // 0xE8
+    template<typename T> int SbcImm(); // 0xE9
     int XbaImp(); // 0xEB
     int BeqRel(); // 0xF0
     int PeaImm(); // 0xF4
-    int PlxImp(); // 0xFA
+    template<typename T> int PlxImp(); // 0xFA
     int XceImp(); // 0xFB
     int JsrAbx(); // 0xFC
-    int SbcLnX(); // 0xFF [long],X
 
-    using CPUFunc = std::function<int()>;
-    std::unordered_map<uint8_t, CPUFunc> opcodes;
+    int UnknownOp();
+
+    // One table per M/X combination, indexed by (M << 1) | X.
+    // Emulation mode forces M and X and so always runs from tables[3].
+    using CPUFunc = int (CPU::*)();
+    CPUFunc tables[4][256];
+    CPUFunc* opcodes;
+
+    template<bool M, bool X> void BuildTable(CPUFunc* table);
+    void UpdateMode();
+    uint8_t mode;   // Index of the active table
+
+    // Cache of decoded ROM instructions, direct mapped on PBR:PC. Code in
+    // RAM is never cached and always goes through the bus.
+    struct DecodedOp
+    {
+        uint32_t tag;           // PBR:PC << 2 | mode, ~0 if empty
+        CPUFunc func;
+        uint8_t opcode;
+        uint8_t operands[3];
+        uint8_t length;         // Opcode plus operand bytes
+        bool fast;              // Fetched from where MEMSEL can select FastROM
+    };
+
+    static constexpr int DecodeCacheSize = 1 << 16;
+    DecodedOp* decode_cache;
+
+    static uint32_t DecodeIndex(uint32_t addr)
+    {
+        return (addr ^ (addr >> 9)) & (DecodeCacheSize-1);
+    }
+
+    // A CPU cycle is 8 master clocks, a FastROM fetch only takes 6. The
+    // leftover fraction of a cycle is carried over to the next instruction.
+    int fast_clocks = 0;
+    int FastFetch(int bytes);
+
+    const uint8_t* fetch = nullptr;     // Operands of the cached instruction being run
+    DecodedOp* decoding = nullptr;      // Entry being filled in by the current instruction
+
+#ifdef SNES_JIT
+    // Hot ROM blocks compiled to x86-64, see jit.cpp
+    using BlockFunc = int (*)();
+
+    struct Block
+    {
+        uint32_t tag;           // Same key as DecodedOp
+        uint16_t d;             // Direct page it was compiled for
+        uint32_t hits;
+        BlockFunc code;         // nullptr until the block gets hot
+        uint8_t fetch_bytes;    // Instruction bytes, for FastROM timing
+        uint8_t length;         // Instructions in the block
+        bool fast;
+    };
+
+    static constexpr int BlockCacheSize = 1 << 14;
+    static constexpr uint32_t JitThreshold = 32;
+    static constexpr int MaxBlockLength = 32;
+
+    Block* blocks = nullptr;
+    bool block_start = true;    // Set when pc may be the start of a block
+
+    void InitJit();
+    void FlushBlocks();
+    bool RunBlock(int& cycles);
+    BlockFunc CompileBlock(uint32_t addr, uint8_t& fetch_bytes, uint8_t& length);
+    static bool EndsBlock(uint8_t opcode);
+    static bool TouchesIO(const DecodedOp& op, bool dp_ram);
+    static int RunOp(CPU* cpu, const DecodedOp* op);
+#endif
 
     bool e = true;
 
+    // Idle loop detection. A backward branch that lands on the same loop
+    // with the same registers and nothing written or read through a
+    // stepping register (see Bus::SteppingReads) since the last time it ran
+    // can only leave the loop once the PPU, APU or an interrupt changes
+    // what it reads.
+    struct IdleState
+    {
+        uint32_t branch;        // PBR:PC of the branch, ~0 if none
+        uint16_t a, x, y, sp, d;
+        uint8_t p, dbr;
+        bool e;
+
+        bool operator==(const IdleState& o) const
+        {
+            return branch == o.branch && a == o.a && x == o.x && y == o.y && sp == o.sp
+                && d == o.d && p == o.p && dbr == o.dbr && e == o.e;
+        }
+    };
+
+    static constexpr int MaxIdleLoop = 32;     // Bytes from loop start to the branch
+
+    IdleState idle_state = {~0u, 0, 0, 0, 0, 0, 0, 0, false};
+    uint32_t writes = 0;        // Bumped by every CPU bus write
+    uint32_t idle_writes = 0;   // writes when idle_state was taken
+    uint32_t idle_reads = 0;    // Bus::SteppingReads() when idle_state was taken
+    int ran = 1;                // Instructions the last Clock ran
+    bool idle = false;          // Last instruction closed an idle iteration
+    bool waiting = false;       // Halted by WAI until NMI or IRQ is pending
+
+    void CheckIdle(uint16_t target);
+
+#ifdef SNES_TRACE
+    Trace::Record* trace_rec = nullptr;
+    int trace_operands = 0;
+    void TraceOperand(uint8_t data);
+#endif
+
     void Push8(uint8_t data);
     void Push16(uint16_t data);
+    template<typename T> void Push(T data);
 
     uint8_t Pop8();
     uint16_t Pop16();
+    template<typename T> T Pop();
+
+    // Pushes PBR, PC and P and jumps through a native mode vector
+    void DoInterrupt(uint16_t vector);
+    int CheckInterrupts();
 public:
     CPU();
 
-    void DoNMI();
-
     int Clock();
+
+    // Instructions the last Clock ran, more than one for a compiled block
+    int Ran() const { return ran; }
+
+    // Nothing the CPU does until the next PPU or APU event is observable
+    bool Idle() const { return idle || waiting; }
+
     void Dump();
 };
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include "interrupt.h"
+
+namespace Interrupt
+{
+
+uint8_t pending = 0;
+
+uint8_t nmitimen = 0;
+uint16_t htime = 0x1FF;
+uint16_t vtime = 0x1FF;
+
+bool rdnmi = false;     // Bit 7 of $4210, set at vblank, cleared on read
+bool timeup = false;    // Bit 7 of $4211, set with the timer IRQ
+
+void SetVblank(bool set)
+{
+    rdnmi = set;
+    if (set && (nmitimen & 0x80))
+        pending |= NMI;
+}
+
+void CheckTimer(int scanline, int from, int to)
+{
+    switch (nmitimen & 0x30)
+    {
+    case 0x00:
+        return;
+    case 0x10:  // Every line at HTIME
+        break;
+    case 0x20:  // Start of line VTIME
+        if (scanline != vtime)
+            return;
+        if (from != 0)
+            return;
+        break;
+    case 0x30:  // Line VTIME at HTIME
+        if (scanline != vtime)
+            return;
+        break;
+    }
+
+    if ((nmitimen & 0x10) && (htime < from || htime >= to))
+        return;
+
+    timeup = true;
+    pending |= IRQ;
+}
+
+int NextTimer(int scanline, int from)
+{
+    // The V only timer fires at dot 0, which is a scanline boundary anyway
+    if (!(nmitimen & 0x10) || htime < from)
+        return 341;
+    if ((nmitimen & 0x20) && scanline != vtime)
+        return 341;
+    return htime;
+}
+
+void TakeNMI()
+{
+    pending &= ~NMI;
+}
+
+void WriteNMITIMEN(uint8_t data)
+{
+    // Enabling NMI in the middle of vblank fires it straight away
+    if ((data & 0x80) && !(nmitimen & 0x80) && rdnmi)
+        pending |= NMI;
+
+    // Turning the timer off also drops an IRQ it already raised
+    if (!(data & 0x30))
+    {
+        timeup = false;
+        pending &= ~IRQ;
+    }
+
+    nmitimen = data;
+}
+
+void WriteHTIMEL(uint8_t data)
+{
+    htime = (htime & 0x100) | data;
+}
+
+void WriteHTIMEH(uint8_t data)
+{
+    htime = (htime & 0xFF) | ((data & 1) << 8);
+}
+
+void WriteVTIMEL(uint8_t data)
+{
+    vtime = (vtime & 0x100) | data;
+}
+
+void WriteVTIMEH(uint8_t data)
+{
+    vtime = (vtime & 0xFF) | ((data & 1) << 8);
+}
+
+uint8_t ReadRDNMI()
+{
+    // Low nibble is the 5A22 version
+    uint8_t data = (rdnmi << 7) | 0x02;
+    rdnmi = false;
+    return data;
+}
+
+uint8_t ReadTIMEUP()
+{
+    uint8_t data = timeup << 7;
+    timeup = false;
+    pending &= ~IRQ;
+    return data;
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+// The 5A22's interrupt logic: NMI on vblank, the H/V timer IRQ and the
+// registers that control them. The PPU raises lines here, the CPU looks at
+// them between instructions.
+namespace Interrupt
+{
+
+enum Lines
+{
+    NMI = (1 << 0),
+    IRQ = (1 << 1),
+};
+
+// Lines waiting for the CPU. NMI is an edge and is cleared once taken, IRQ
+// is a level and stays up until TIMEUP is read.
+extern uint8_t pending;
+
+void SetVblank(bool set);
+
+// The PPU moved from dot "from" up to, not including, "to" on this scanline
+void CheckTimer(int scanline, int from, int to);
+
+// Dot of the next timer IRQ on this scanline at or after "from", 341 if none
+int NextTimer(int scanline, int from);
+
+void TakeNMI();
+
+void WriteNMITIMEN(uint8_t data);
+void WriteHTIMEL(uint8_t data);
+void WriteHTIMEH(uint8_t data);
+void WriteVTIMEL(uint8_t data);
+void WriteVTIMEH(uint8_t data);
+
+uint8_t ReadRDNMI();
+uint8_t ReadTIMEUP();
+
+}
@@ -0,0 +1,458 @@
+// x86-64 block compiler for the 65816 core.
+//
+// A ROM address that starts a block (anything reached through a branch,
+// jump, return, mode change or interrupt) counts how often it runs. Once it
+// reaches JitThreshold, the straight-line run of predecoded instructions
+// that follows it is compiled into one native function. M and X are fixed
+// for the whole block, so every handler is picked for the right register
+// width at compile time. Simple register and flag instructions are emitted
+// inline; everything else is a direct call into the same handler the
+// interpreter uses, so the cycle counts a block returns are exactly the sum
+// of what CPU::Clock would have returned for each instruction.
+//
+// Code in RAM is never compiled, it isn't in the decode cache to begin
+// with. Blocks end at the first instruction that can change pc, the
+// register widths or D, so a compiled block never needs to bail out. They
+// also end after anything that may access the PPU, DMA or interrupt
+// registers, so a DMA, NMI or IRQ that access starts isn't held up by the
+// rest of the block. D is part of the block key, and with the direct page
+// outside of WRAM every direct page access counts as one of those.
+
+#include "cpu.h"
+
+#include "../mem/Bus.h"
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <sys/mman.h>
+
+#ifndef __x86_64__
+#error "SNES_JIT needs an x86-64 host"
+#endif
+
+static constexpr size_t CodeSize = 16*1024*1024;
+
+// Code grows up from the start of the buffer, the operand copies handler
+// calls point at grow down from the end
+uint8_t* code_buf = nullptr;
+size_t code_used = 0;
+size_t data_used = 0;
+
+namespace
+{
+
+struct Emitter
+{
+    uint8_t* start;
+    uint8_t* cur;
+    uint8_t* end;
+
+    bool full = false;
+
+    void Byte(uint8_t b)
+    {
+        if (cur < end)
+            *cur++ = b;
+        else
+            full = true;
+    }
+
+    // Room for a T below the code, nullptr once the buffer is full
+    template<typename T> T* Data()
+    {
+        uintptr_t p = ((uintptr_t)end - sizeof(T)) & ~(uintptr_t)(alignof(T) - 1);
+        if (p < (uintptr_t)cur)
+        {
+            full = true;
+            return nullptr;
+        }
+        end = (uint8_t*)p;
+        return (T*)p;
+    }
+
+    void Bytes(std::initializer_list<uint8_t> bytes)
+    {
+        for (uint8_t b : bytes)
+            Byte(b);
+    }
+
+    void Imm16(uint16_t v)
+    {
+        Byte(v);
+        Byte(v >> 8);
+    }
+
+    void Imm64(uint64_t v)
+    {
+        for (int i = 0; i < 8; i++)
+            Byte(v >> (i*8));
+    }
+
+    // mov rax, ptr
+    void LoadRax(const void* ptr)
+    {
+        Bytes({0x48, 0xB8});
+        Imm64((uint64_t)ptr);
+    }
+
+    // add r12d, imm8
+    void AddCycles(int cycles)
+    {
+        Bytes({0x41, 0x83, 0xC4, (uint8_t)cycles});
+    }
+
+    // and byte [p], ~mask ; or byte [p], set
+    void SetFlags(uint8_t* p, uint8_t mask, uint8_t set)
+    {
+        LoadRax(p);
+        Bytes({0x80, 0x20, (uint8_t)~mask});
+        if (set)
+            Bytes({0x80, 0x08, set});
+    }
+
+    // mov byte [ptr], imm8
+    void StoreByte(void* ptr, uint8_t v)
+    {
+        LoadRax(ptr);
+        Bytes({0xC6, 0x00, v});
+    }
+
+    // mov word [ptr], imm16
+    void StoreWord(void* ptr, uint16_t v)
+    {
+        LoadRax(ptr);
+        Bytes({0x66, 0xC7, 0x00});
+        Imm16(v);
+    }
+
+    // Stores the register at [rax] as the lazy N/Z result
+    void StoreNZ(uint8_t* flag_n, uint16_t* flag_z, bool wide)
+    {
+        if (wide)
+            Bytes({0x0F, 0xB7, 0x08});  // movzx ecx, word [rax]
+        else
+            Bytes({0x0F, 0xB6, 0x08});  // movzx ecx, byte [rax]
+        LoadRax(flag_z);
+        Bytes({0x66, 0x89, 0x08});      // mov word [rax], cx
+        if (wide)
+            Bytes({0xC1, 0xE9, 0x08});  // shr ecx, 8
+        LoadRax(flag_n);
+        Bytes({0x88, 0x08});            // mov byte [rax], cl
+    }
+};
+
+}
+
+void CPU::InitJit()
+{
+    code_buf = (uint8_t*)mmap(nullptr, CodeSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code_buf == MAP_FAILED)
+    {
+        printf("[JIT]: Couldn't map code buffer, running interpreted\n");
+        code_buf = nullptr;
+        return;
+    }
+
+    blocks = new Block[BlockCacheSize];
+    for (int i = 0; i < BlockCacheSize; i++)
+    {
+        blocks[i].tag = ~0u;
+        blocks[i].d = 0;
+        blocks[i].hits = 0;
+        blocks[i].code = nullptr;
+    }
+}
+
+// Throws away all compiled code. Only safe outside of a block.
+void CPU::FlushBlocks()
+{
+    code_used = 0;
+    data_used = 0;
+    for (int i = 0; i < BlockCacheSize; i++)
+    {
+        blocks[i].hits = 0;
+        blocks[i].code = nullptr;
+    }
+}
+
+bool CPU::EndsBlock(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    // Branches
+    case 0x10: case 0x30: case 0x50: case 0x70:
+    case 0x80: case 0x82: case 0x90: case 0xB0:
+    case 0xD0: case 0xF0:
+    // Jumps, calls and returns
+    case 0x20: case 0x22: case 0x4C: case 0x5C:
+    case 0x6C: case 0x7C: case 0xDC: case 0xFC:
+    case 0x40: case 0x60: case 0x6B:
+    // Interrupts and halts
+    case 0x00: case 0x02: case 0xCB: case 0xDB:
+    // Anything that can change M, X or E
+    case 0x28: case 0xC2: case 0xE2: case 0xFB:
+    // Or D
+    case 0x2B: case 0x5B:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Absolute accesses to $21xx, $42xx or $43xx, and stores that are indexed
+// or go through a pointer, since those can land anywhere. Direct page
+// accesses only count when D doesn't point into WRAM.
+bool CPU::TouchesIO(const DecodedOp& op, bool dp_ram)
+{
+    if (!dp_ram)
+    {
+        switch (op.opcode & 0x1F)
+        {
+        // dp, dp,X, dp,Y, (dp), [dp], (dp,X), (dp),Y, [dp],Y
+        case 0x01: case 0x05: case 0x06: case 0x07:
+        case 0x11: case 0x12: case 0x15: case 0x16: case 0x17:
+            return true;
+        // Same for the x4 column, less MVP, MVN and PEA
+        case 0x04: case 0x14:
+            if (op.opcode != 0x44 && op.opcode != 0x54 && op.opcode != 0xF4)
+                return true;
+            break;
+        }
+    }
+
+    switch (op.opcode)
+    {
+    // Absolute and absolute long
+    case 0x0D: case 0x2D: case 0x4D: case 0x6D: case 0x8D: case 0xAD: case 0xCD: case 0xED:
+    case 0x0E: case 0x2E: case 0x4E: case 0x6E: case 0x8E: case 0xAE: case 0xCE: case 0xEE:
+    case 0x0C: case 0x1C: case 0x2C: case 0x8C: case 0x9C: case 0xAC: case 0xCC: case 0xEC:
+    case 0x0F: case 0x2F: case 0x4F: case 0x6F: case 0x8F: case 0xAF: case 0xCF: case 0xEF:
+    {
+        uint16_t addr = op.operands[0] | (op.operands[1] << 8);
+        return (addr & 0xFF00) == 0x2100 || (addr & 0xFE00) == 0x4200;
+    }
+    // Indexed stores and read-modify-writes
+    case 0x9D: case 0x99: case 0x9E: case 0x9F:
+    case 0x1E: case 0x3E: case 0x5E: case 0x7E: case 0xDE: case 0xFE:
+    case 0x95: case 0x94: case 0x96: case 0x74:
+    case 0x16: case 0x36: case 0x56: case 0x76: case 0xD6: case 0xF6:
+    // Indirect stores and block moves
+    case 0x81: case 0x87: case 0x91: case 0x92: case 0x93: case 0x97:
+    case 0x44: case 0x54:
+        return true;
+    default:
+        return false;
+    }
+}
+
+int CPU::RunOp(CPU* cpu, const DecodedOp* op)
+{
+    cpu->fetch = op->operands;
+    int cycles = (cpu->*op->func)();
+    cpu->fetch = nullptr;
+    return cycles;
+}
+
+bool CPU::RunBlock(int& cycles)
+{
+    if (!blocks)
+        return false;
+
+#ifdef SNES_TRACE
+    // Compiled blocks don't produce trace records
+    if (Trace::Enabled())
+        return false;
+#endif
+
+#ifdef SNES_PROFILE
+    // Nor per-instruction samples
+    if (Profile::Enabled())
+        return false;
+#endif
+
+    uint32_t addr = pbr << 16 | pc;
+    uint32_t tag = addr << 2 | mode;
+    Block& b = blocks[(addr ^ (addr >> 11)) & (BlockCacheSize-1)];
+
+    if (b.tag != tag || b.d != d)
+    {
+        b.tag = tag;
+        b.d = d;
+        b.hits = 0;
+        b.code = nullptr;
+    }
+
+    if (!b.code)
+    {
+        if (++b.hits != JitThreshold)
+            return false;
+
+        b.code = CompileBlock(addr, b.fetch_bytes, b.length);
+        if (!b.code)
+            return false;
+        b.fast = Bus::IsFastRegion(addr);
+    }
+
+    cycles = b.code();
+    if (b.fast && Bus::FastROM())
+        cycles -= FastFetch(b.fetch_bytes);
+    ran = b.length;
+    block_start = true;
+    return true;
+}
+
+CPU::BlockFunc CPU::CompileBlock(uint32_t addr, uint8_t& fetch_bytes, uint8_t& length)
+{
+    if (!code_buf)
+        return nullptr;
+
+    Emitter em;
+    em.start = em.cur = code_buf + code_used;
+    em.end = code_buf + CodeSize - data_used;
+
+    bool m8 = GetFlag(MF);
+    bool x8 = GetFlag(XBF);
+    bool dp_ram = d < 0x1F00;   // Every dp access stays below $2000
+    uint8_t* pp = &p;
+
+    // push rbx ; push r12 ; sub rsp, 8 ; xor r12d, r12d ; mov rbx, this
+    em.Bytes({0x53, 0x41, 0x54, 0x48, 0x83, 0xEC, 0x08, 0x45, 0x31, 0xE4});
+    em.Bytes({0x48, 0xBB});
+    em.Imm64((uint64_t)this);
+
+    uint8_t bank = addr >> 16;
+    uint16_t cur_pc = addr;
+    fetch_bytes = 0;
+    bool ended = false;
+    int count = 0;
+
+    for (; count < MaxBlockLength; count++)
+    {
+        uint32_t op_addr = bank << 16 | cur_pc;
+        const DecodedOp& op = decode_cache[DecodeIndex(op_addr)];
+        if (op.tag != (op_addr << 2 | mode))
+            break;
+
+        uint8_t opcode = op.opcode;
+        uint16_t next_pc = cur_pc + op.length;
+
+        // Instructions simple enough to emit inline, with M and X folded in
+        uint16_t* reg = nullptr;
+        bool wide = false;
+        switch (opcode)
+        {
+        case 0x18: em.StoreByte(&flag_c, 0); em.AddCycles(2); break;   // clc
+        case 0x38: em.StoreByte(&flag_c, 1); em.AddCycles(2); break;   // sec
+        case 0x78: em.SetFlags(pp, IF, IF); em.AddCycles(2); break;    // sei
+        case 0xD8: em.SetFlags(pp, DF, 0); em.AddCycles(2); break;     // cld
+        case 0xA9: reg = &a.full; wide = !m8; break;                    // lda #
+        case 0xA2: reg = &x.full; wide = !x8; break;                    // ldx #
+        case 0xA0: reg = &y.full; wide = !x8; break;                    // ldy #
+        case 0x1A: case 0x3A: reg = &a.full; wide = !m8; break;         // inc/dec a
+        case 0xE8: case 0xCA: reg = &x.full; wide = !x8; break;         // inx/dex
+        case 0xC8: case 0x88: reg = &y.full; wide = !x8; break;         // iny/dey
+        default:
+        {
+            // mov word [pc], cur_pc+1 ; mov rdi, rbx ; mov rsi, op ; mov rax, RunOp ; call rax ; add r12d, eax
+            DecodedOp* copy = em.Data<DecodedOp>();
+            if (copy)
+                *copy = op;
+            em.LoadRax(&pc);
+            em.Bytes({0x66, 0xC7, 0x00});
+            em.Imm16(cur_pc + 1);
+            em.Bytes({0x48, 0x89, 0xDF});
+            em.Bytes({0x48, 0xBE});
+            em.Imm64((uint64_t)copy);
+            em.LoadRax((void*)&CPU::RunOp);
+            em.Bytes({0xFF, 0xD0});
+            em.Bytes({0x41, 0x01, 0xC4});
+            break;
+        }
+        }
+
+        if (reg)
+        {
+            em.LoadRax(reg);
+            switch (opcode)
+            {
+            case 0xA9: case 0xA2: case 0xA0:
+            {
+                // Loads of a constant also have constant flags
+                uint16_t imm = op.operands[0] | (wide ? op.operands[1] << 8 : 0);
+                if (wide)
+                {
+                    em.Bytes({0x66, 0xC7, 0x00});
+                    em.Imm16(imm);
+                }
+                else
+                    em.Bytes({0xC6, 0x00, (uint8_t)imm});
+                em.StoreWord(&flag_z, imm);
+                em.StoreByte(&flag_n, wide ? imm >> 8 : imm);
+                em.AddCycles(wide ? 3 : 2);
+                break;
+            }
+            case 0x1A: case 0xE8: case 0xC8:
+                if (wide)
+                    em.Bytes({0x66, 0xFF, 0x00});       // inc word [rax]
+                else
+                    em.Bytes({0xFE, 0x00});             // inc byte [rax]
+                em.StoreNZ(&flag_n, &flag_z, wide);
+                em.AddCycles(2);
+                break;
+            default:
+                if (wide)
+                    em.Bytes({0x66, 0xFF, 0x08});       // dec word [rax]
+                else
+                    em.Bytes({0xFE, 0x08});             // dec byte [rax]
+                em.StoreNZ(&flag_n, &flag_z, wide);
+                em.AddCycles(2);
+                break;
+            }
+        }
+
+        cur_pc = next_pc;
+        fetch_bytes += op.length;
+
+        if (EndsBlock(opcode))
+        {
+            ended = true;
+            count++;
+            break;
+        }
+
+        // Give the rest of the system a chance to react
+        if (TouchesIO(op, dp_ram))
+        {
+            count++;
+            break;
+        }
+    }
+
+    if (!count)
+        return nullptr;
+
+    // Falling out of the block, continue with the next instruction
+    if (!ended)
+    {
+        em.LoadRax(&pc);
+        em.Bytes({0x66, 0xC7, 0x00});
+        em.Imm16(cur_pc);
+    }
+
+    // mov eax, r12d ; add rsp, 8 ; pop r12 ; pop rbx ; ret
+    em.Bytes({0x44, 0x89, 0xE0, 0x48, 0x83, 0xC4, 0x08, 0x41, 0x5C, 0x5B, 0xC3});
+
+    // Out of room, start over with an empty buffer
+    if (em.full)
+    {
+        if (!code_used && !data_used)
+            return nullptr;
+        FlushBlocks();
+        return CompileBlock(addr, fetch_bytes, length);
+    }
+
+    code_used = em.cur - code_buf;
+    data_used = code_buf + CodeSize - em.end;
+    length = count;
+    return (BlockFunc)em.start;
+}
@@ -0,0 +1,182 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Profile
+{
+
+struct Counts
+{
+    uint64_t instructions;
+    uint64_t cycles;
+};
+
+// One node per distinct call path, node 0 is everything outside any call
+struct Node
+{
+    uint32_t parent;
+    uint32_t target;
+    Frame kind;
+    int depth;
+    uint64_t cycles;    // Charged while this was the innermost frame
+};
+
+// Code that leaves subroutines without returning would grow the tree
+// forever, calls deeper than this stay in their caller's node
+static constexpr int MaxDepth = 128;
+
+bool enabled = false;
+int interval = 1;
+int countdown = INT_MAX;
+
+std::unordered_map<uint32_t, Counts> pcs;
+std::vector<Node> nodes;
+std::unordered_map<uint64_t, uint32_t> children;   // Keyed on parent, kind and target
+uint32_t current = 0;
+int overflow = 0;       // Calls not entered because of MaxDepth
+
+void Enable(int every)
+{
+    interval = std::max(every, 1);
+    countdown = interval;
+
+    pcs.clear();
+    children.clear();
+    nodes.clear();
+    nodes.push_back({0, 0, Sub, 0, 0});
+    current = 0;
+    overflow = 0;
+
+    enabled = true;
+}
+
+void Disable()
+{
+    enabled = false;
+    countdown = INT_MAX;
+}
+
+bool Enabled()
+{
+    return enabled;
+}
+
+void Sample(uint32_t pc, int cycles)
+{
+    if (!enabled)
+    {
+        countdown = INT_MAX;
+        return;
+    }
+
+    countdown = interval;
+
+    Counts& counts = pcs[pc];
+    counts.instructions += interval;
+    counts.cycles += (uint64_t)cycles * interval;
+
+    nodes[current].cycles += (uint64_t)cycles * interval;
+}
+
+void Call(uint32_t target, Frame kind)
+{
+    if (!enabled)
+        return;
+
+    if (nodes[current].depth >= MaxDepth)
+    {
+        overflow++;
+        return;
+    }
+
+    uint64_t key = (uint64_t)current << 32 | kind << 24 | target;
+    auto it = children.find(key);
+    if (it != children.end())
+    {
+        current = it->second;
+        return;
+    }
+
+    uint32_t node = nodes.size();
+    nodes.push_back({current, target, kind, nodes[current].depth + 1, 0});
+    children[key] = node;
+    current = node;
+}
+
+void Return()
+{
+    if (!enabled)
+        return;
+
+    if (overflow)
+        overflow--;
+    else if (current)
+        current = nodes[current].parent;
+}
+
+std::string FrameName(const Node& node)
+{
+    static const char* prefix[] = {"sub", "nmi", "irq"};
+
+    char name[16];
+    snprintf(name, sizeof(name), "%s_%06x", prefix[node.kind], node.target);
+    return name;
+}
+
+void Dump(const char* name)
+{
+    if (nodes.empty())
+        return;
+
+    std::string base = name;
+
+    // Hottest PCs first
+    std::vector<std::pair<uint32_t, Counts>> sorted(pcs.begin(), pcs.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second.cycles > b.second.cycles;
+    });
+
+    uint64_t total = 0;
+    for (auto& entry : sorted)
+        total += entry.second.cycles;
+
+    FILE* out = fopen((base + ".txt").c_str(), "w");
+    if (!out)
+        return;
+
+    fprintf(out, "# sampled every %d instructions\n", interval);
+    fprintf(out, "# pc       instructions       cycles      %%\n");
+    for (auto& [pc, counts] : sorted)
+        fprintf(out, "%06x %15lu %12lu %6.2f\n", pc, (unsigned long)counts.instructions,
+            (unsigned long)counts.cycles, total ? 100.0 * counts.cycles / total : 0.0);
+    fclose(out);
+
+    // One line per call path: outermost frame first, then the cycles spent in it
+    out = fopen((base + ".folded").c_str(), "w");
+    if (!out)
+        return;
+
+    for (uint32_t i = 0; i < nodes.size(); i++)
+    {
+        if (!nodes[i].cycles)
+            continue;
+
+        std::vector<uint32_t> path;
+        for (uint32_t n = i; n; n = nodes[n].parent)
+            path.push_back(n);
+
+        std::string line = "reset";
+        for (auto it = path.rbegin(); it != path.rend(); ++it)
+            line += ";" + FrameName(nodes[*it]);
+
+        fprintf(out, "%s %lu\n", line.c_str(), (unsigned long)nodes[i].cycles);
+    }
+    fclose(out);
+}
+
+}
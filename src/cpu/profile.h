@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+// Guest code profiler. With SNES_PROFILE the CPU reports every call, return
+// and interrupt, and every interval-th instruction, which is charged for
+// interval times its cycles. Dump writes per-PC totals and folded stacks
+// that flamegraph.pl and speedscope read directly.
+namespace Profile
+{
+
+enum Frame
+{
+    Sub,
+    NMI,
+    IRQ,
+};
+
+// interval 1 counts every instruction exactly
+void Enable(int interval);
+void Disable();
+bool Enabled();
+
+// Instructions left until the next sample
+extern int countdown;
+
+void Sample(uint32_t pc, int cycles);
+
+inline void Instruction(uint32_t pc, int cycles)
+{
+    if (--countdown <= 0)
+        Sample(pc, cycles);
+}
+
+// Entering a subroutine or interrupt handler at target, and leaving it
+void Call(uint32_t target, Frame kind);
+void Return();
+
+// Writes name.txt, the hottest PCs, and name.folded, the call stacks
+void Dump(const char* name);
+
+}
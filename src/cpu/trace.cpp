@@ -0,0 +1,70 @@
+#include "trace.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace Trace
+{
+
+Record* ring = nullptr;
+size_t ring_size = 0;
+uint64_t head = 0;
+bool enabled = false;
+
+void Enable(size_t entries)
+{
+    size_t size = 1;
+    while (size < entries)
+        size <<= 1;
+
+    if (size != ring_size)
+    {
+        delete[] ring;
+        ring = new Record[size];
+        ring_size = size;
+    }
+
+    head = 0;
+    enabled = true;
+}
+
+void Disable()
+{
+    enabled = false;
+}
+
+bool Enabled()
+{
+    return enabled;
+}
+
+Record* Next()
+{
+    Record* rec = &ring[head++ & (ring_size-1)];
+    memset(rec, 0, sizeof(Record));
+    return rec;
+}
+
+void Dump(const char* name)
+{
+    if (!ring)
+        return;
+
+    uint64_t count = head < ring_size ? head : ring_size;
+    uint64_t first = head - count;
+
+    FileHeader hdr;
+    memcpy(hdr.magic, "SNTR", 4);
+    hdr.version = Version;
+    hdr.count = count;
+
+    std::ofstream out(name, std::ios::binary);
+    out.write((char*)&hdr, sizeof(hdr));
+
+    for (uint64_t i = first; i < head; i++)
+        out.write((char*)&ring[i & (ring_size-1)], sizeof(Record));
+
+    out.close();
+}
+
+}
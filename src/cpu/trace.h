@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Binary instruction trace. The CPU only records into it when built with
+// SNES_TRACE, so a normal build pays nothing for it. tools/tracedump.cpp
+// turns a dumped trace back into the old text log.
+namespace Trace
+{
+
+// One executed instruction, with the register file as it was before it ran
+struct Record
+{
+    uint32_t pc;            // PBR:PC of the opcode
+    uint8_t opcode;
+    uint8_t operands[3];    // Operand bytes, in fetch order
+    uint16_t a, x, y, s, d;
+    uint8_t dbr;
+    uint8_t p;
+    uint8_t e;
+    uint8_t cycles;         // Cycles the instruction took
+    uint8_t reserved[2];
+};
+
+static_assert(sizeof(Record) == 24, "Trace::Record is a file format");
+
+// Written at the start of a trace file, followed by count records
+struct FileHeader
+{
+    char magic[4];          // "SNTR"
+    uint32_t version;
+    uint64_t count;
+};
+
+constexpr uint32_t Version = 1;
+
+// entries is rounded up to a power of two
+void Enable(size_t entries);
+void Disable();
+bool Enabled();
+
+Record* Next();
+
+// Writes the buffered records, oldest first
+void Dump(const char* name);
+
+}
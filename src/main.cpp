@@ -1,7 +1,10 @@
 #include "mem/Bus.h"
 #include "cpu/cpu.h"
+#include "cpu/profile.h"
+#include "cpu/trace.h"
 #include "ppu/ppu.h"
 #include "sound/spc700.h"
+#include "system.h"
 
 #include <cstdlib>
 #include <SDL2/SDL.h>
@@ -14,6 +17,8 @@ void e()
     Bus::Dump();
     PPU::Dump();
     SPC700::Dump();
+    Trace::Dump("trace.bin");
+    Profile::Dump("profile");
 }
 
 uint64_t a, b;
@@ -21,25 +26,24 @@ double delta;
 
 int main()
 {
-    Bus::Init();
-    PPU::Init();
-    SPC700::LoadIPL("spc700.rom");
-    SPC700::Reset();
+#ifdef SNES_TRACE
+    // Keeps the last ~1M instructions
+    Trace::Enable(1 << 20);
+#endif
 
-    cpu = new CPU();
+#ifdef SNES_PROFILE
+    // SNES_PROFILE_INTERVAL=n only samples every n-th instruction
+    const char* interval = getenv("SNES_PROFILE_INTERVAL");
+    Profile::Enable(interval ? atoi(interval) : 1);
+#endif
 
-    std::atexit(e);
+    cpu = System::PowerOn();
+    PPU::OpenWindow();
 
-    PPU::Tick(34);
+    std::atexit(e);
 
     while (1)
-    {
-        int cycles = 0;
-        for (int i = 0; i < 4; i++)
-            cycles += cpu->Clock();
-        PPU::Tick((cycles*8)/4);
-        SPC700::Tick((int)(cycles / 1.3358209));
-    }
+        System::Step(cpu);
 
     return 0;
 }
\ No newline at end of file
@@ -1,25 +1,128 @@
 #include "Bus.h"
 #include "../ppu/ppu.h"
 #include "hdma.h"
-#include "../cpu/cpu.h"
+#include "cartridge.h"
+#include "dirty.h"
+#include "../cpu/interrupt.h"
 #include "../sound/spc700.h"
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <map>
 
-uint8_t* rom;
-size_t rom_size;
 uint8_t* ram;
 
-void Bus::Init()
+// The 24-bit address space in 4 KB pages. RAM and ROM pages point straight
+// at host memory, everything else is served by one of the handlers below.
+static constexpr int PageBits = 12;
+static constexpr int PageCount = 1 << (24 - PageBits);
+static constexpr uint32_t PageMask = (1 << PageBits) - 1;
+
+enum Handler : uint8_t
+{
+    Unmapped,   // Nothing is there
+    IO,         // $2000-$FFFF in banks $00-$3F and $80-$BF, registers and ROM writes
+};
+
+struct Page
 {
-    std::ifstream file("doom.smc", std::ios::ate | std::ios::binary);
-    rom_size = file.tellg();
+    uint8_t* read;      // Host memory backing the page, nullptr to use the handler
+    uint8_t* write;     // Same for writes, nullptr for ROM
+    Handler handler;
+};
 
-    rom = new uint8_t[rom_size];
+Page pages[PageCount];
 
-    file.seekg(0, std::ios::beg);
-    file.read((char*)rom, rom_size);
+// Accesses that no handler served, keyed by address with bit 16 set for writes
+std::map<uint32_t, uint32_t> unhandled;
+
+void MapPages(uint8_t first_bank, uint8_t last_bank, uint16_t start, uint16_t end, uint8_t* read, uint8_t* write, Handler handler);
+void MapRom(uint8_t bank, uint16_t start, uint16_t end, uint32_t offset, Handler handler);
+void InitRegisters();
+
+void Bus::Init()
+{
+    Cartridge::Load("doom.smc");
 
     ram = new uint8_t[128*1024];
+    Dirty::SetMemory(Dirty::WRAM, ram);
+
+    MapPages(0x00, 0xFF, 0x0000, 0xFFFF, nullptr, nullptr, Unmapped);
+
+    // System area, the same in both halves of the address space. ROM
+    // writes here go to the IO handler, which reports them.
+    for (int base : {0x00, 0x80})
+    {
+        MapPages(base, base + 0x3F, 0x0000, 0x1FFF, ram, ram, IO);
+        MapPages(base, base + 0x3F, 0x2000, 0xFFFF, nullptr, nullptr, IO);
+    }
+
+    for (int bank = 0x00; bank <= 0xFF; bank++)
+    {
+        if (bank == 0x7E || bank == 0x7F)
+            continue;
+
+        uint8_t b = bank & 0x7F;
+        bool system = b < 0x40;
+        Handler handler = system ? IO : Unmapped;
+
+        switch (Cartridge::GetLayout())
+        {
+        case Cartridge::LoROM:
+            // 32 KB per bank, $40-$6F mirror it into their lower half
+            MapRom(bank, 0x8000, 0xFFFF, b << 15, handler);
+            if (b >= 0x40 && b < 0x70)
+                MapRom(bank, 0x0000, 0x7FFF, b << 15, Unmapped);
+            if (Cartridge::HasSuperFX() && b >= 0x40 && b < 0x60)
+                MapRom(bank, 0x0000, 0xFFFF, (b & 0x1F) << 16, Unmapped);
+            break;
+        case Cartridge::HiROM:
+            if (system)
+                MapRom(bank, 0x8000, 0xFFFF, (b << 16) | 0x8000, handler);
+            else
+                MapRom(bank, 0x0000, 0xFFFF, (b & 0x3F) << 16, handler);
+            break;
+        case Cartridge::ExHiROM:
+        {
+            // $C0-$FF and $80-$BF hold the first 4 MB, $40-$7D and $00-$3F the rest
+            uint32_t half = bank & 0x80 ? 0 : 0x400000;
+            if (system)
+                MapRom(bank, 0x8000, 0xFFFF, half + ((b << 16) | 0x8000), handler);
+            else
+                MapRom(bank, 0x0000, 0xFFFF, half + ((b & 0x3F) << 16), handler);
+            break;
+        }
+        }
+    }
+
+    MapPages(0x7E, 0x7E, 0x0000, 0xFFFF, ram, ram, Unmapped);
+    MapPages(0x7F, 0x7F, 0x0000, 0xFFFF, ram + 0x10000, ram + 0x10000, Unmapped);
+
+    InitRegisters();
+}
+
+// Maps start-end of every bank in the range. read and write point at the
+// host memory for start, nullptr leaves that direction to handler.
+void MapPages(uint8_t first_bank, uint8_t last_bank, uint16_t start, uint16_t end, uint8_t* read, uint8_t* write, Handler handler)
+{
+    for (int bank = first_bank; bank <= last_bank; bank++)
+    {
+        for (uint32_t addr = start; addr < (uint32_t)end + 1; addr += PageMask + 1)
+        {
+            Page& page = pages[(bank << 16 | addr) >> PageBits];
+            page.read = read ? read + (addr - start) : nullptr;
+            page.write = write ? write + (addr - start) : nullptr;
+            page.handler = handler;
+        }
+    }
+}
+
+// Maps ROM from offset on at start-end of bank, mirrored past the ROM size
+void MapRom(uint8_t bank, uint16_t start, uint16_t end, uint32_t offset, Handler handler)
+{
+    uint8_t* rom = Cartridge::Data();
+    for (uint32_t addr = start; addr < (uint32_t)end + 1; addr += PageMask + 1)
+        MapPages(bank, bank, addr, addr + PageMask, rom + Cartridge::Mirror(offset + addr - start), nullptr, handler);
 }
 
 void Bus::Dump()
@@ -28,307 +131,445 @@ void Bus::Dump()
 
     dump.write((char*)ram, 128*1024);
     dump.close();
+
+    for (auto& [key, count] : unhandled)
+        printf("[BUS]: %u unhandled %s 0x%04x\n", count, key >> 16 ? "writes to" : "reads from", key & 0xFFFF);
 }
 
-uint8_t timeup;
 uint8_t hvbjoy = 0;
-uint8_t nmitimen = 0;
-bool nmi_flag = false;
+uint8_t memsel = 0;
 
-extern CPU* cpu;
+// Multiply and divide unit, results are ready straight away rather than
+// after the 8 or 16 cycles the hardware takes
+uint8_t wrmpya = 0xFF;
+uint16_t wrdiv = 0xFFFF;
+uint16_t rddiv = 0;
+uint16_t rdmpy = 0;
 
 void Bus::SetVblank(bool set)
-{   
+{
     if (set)
-    {
         hvbjoy |= 0x80;
-
-        if (nmitimen & 0x80)
-            cpu->DoNMI();
-        nmi_flag = true;
-    }
     else
-    {
         hvbjoy &= ~0x80;
-        nmi_flag = false;
-    }
+
+    Interrupt::SetVblank(set);
 }
 
-uint8_t Bus::Read8(uint32_t addr)
+bool Bus::IsFastRegion(uint32_t addr)
 {
-    uint8_t bank = (addr >> 16) & 0xff;
-    addr &= 0xFFFF;
+    return (addr & 0x800000) && ((addr & 0x400000) || (addr & 0x8000));
+}
 
-    switch (bank)
-    {
-    case 0x00 ... 0x3F:
-    {
-        if (addr >= 0x8000)
-            return rom[(((bank&0x3F) << 15) | (addr & 0x7fff)) & (rom_size-1)];
-        if (addr < 0x2000)
-            return ram[addr];
+bool Bus::FastROM()
+{
+    return memsel & 1;
+}
 
-        switch (addr)
-        {
-        case 0x4211:
+bool Bus::IsRom(uint32_t addr)
+{
+    const Page& page = pages[(addr >> PageBits) & (PageCount-1)];
+    return page.read && !page.write;
+}
+
+bool Bus::IsWRAM(uint32_t addr)
+{
+    const Page& page = pages[(addr >> PageBits) & (PageCount-1)];
+    return (uintptr_t)page.read - (uintptr_t)ram < 128*1024;
+}
+
+uint8_t UnmappedRead8(uint32_t addr)
+{
+    printf("Read8 from unknown bank 0x%02x\n", addr >> 16);
+    exit(1);
+}
+
+uint16_t UnmappedRead16(uint32_t addr)
+{
+    printf("Read16 from unknown bank 0x%02x\n", addr >> 16);
+    exit(1);
+}
+
+void UnmappedWrite8(uint32_t addr, uint8_t)
+{
+    printf("Write8 to unknown bank 0x%02x\n", addr >> 16);
+    exit(1);
+}
+
+void UnmappedWrite16(uint32_t addr, uint16_t)
+{
+    printf("Write16 to unknown bank 0x%02x\n", addr >> 16);
+    exit(1);
+}
+
+// WRAM port at $2180-$2183, a 17-bit address that steps on every access
+uint32_t wmadd = 0;
+
+void WriteWMDATA(uint8_t data)
+{
+    wmadd &= 0x1FFFF;
+    ram[wmadd] = data;
+    Dirty::Mark(Dirty::WRAM, wmadd);
+    wmadd++;
+}
+
+// Reads of registers flagged ReadSteps, counted by IORead8
+uint32_t stepping_reads = 0;
+
+uint32_t Bus::SteppingReads()
+{
+    return stepping_reads;
+}
+
+void Bus::WriteWMDATASpan(const uint8_t* src, uint32_t bytes, bool fixed)
+{
+    while (bytes)
+    {
+        wmadd &= 0x1FFFF;
+        uint32_t n = std::min(bytes, 0x20000 - wmadd);
+        if (fixed)
+            memset(ram + wmadd, src[0], n);
+        else
         {
-            uint8_t data = timeup;
-            timeup = 0;
-            return data;
-        }
-        case 0x4210:
-            nmi_flag = true;
-            return nmi_flag;
-        case 0x4212:
-            return hvbjoy;
-        case 0x4016:
-            return 0;
-        case 0x2140 ... 0x2143:
-            return SPC700::ReadPort(addr & 0x3);
+            memcpy(ram + wmadd, src, n);
+            src += n;
         }
-        
-        printf("Read8 from unknown addr 0x%02x:0x%04x\n", bank, addr);
-        exit(1);
+        Dirty::MarkRange(Dirty::WRAM, wmadd, n);
+        wmadd += n;
+        bytes -= n;
     }
-    case 0x40 ... 0x5F:
-    {
-        return rom[(((bank&0x3F) * 0x10000) + addr) & (rom_size-1)];
+}
 
-        printf("Read8 from unknown addr 0x%02x:0x%04x\n", bank, addr);
-        exit(1);
-    }
-    case 0x7F:
-        return ram[0x10000 + (addr & 0xFFFF)];
-    default:
-        printf("Read8 from unknown bank 0x%02x\n", bank);
-        exit(1);
-    }
+// The register file at $2100-$21FF and $4200-$43FF, one entry per address.
+// A register without a handler for the direction it's accessed in is
+// counted and reported the first time, then reads as 0 or drops the write.
+enum RegisterFlags : uint8_t
+{
+    Wide = (1 << 0),        // A 16-bit write is one access to write16, not two byte writes
+    Ignored = (1 << 1),     // Known but not emulated, writes are dropped without a report
+    ReadSteps = (1 << 2),   // A read steps an address, so every read has an effect
+};
+
+struct Register
+{
+    const char* name;
+    uint8_t (*read)(uint16_t addr);
+    void (*write)(uint16_t addr, uint8_t data);
+    void (*write16)(uint16_t addr, uint16_t data);
+    uint8_t flags;
+};
+
+Register registers[0x300];
+
+// Index into registers for $2100-$21FF and $4200-$43FF, -1 otherwise
+static inline int RegisterIndex(uint16_t addr)
+{
+    if ((addr & 0xFF00) == 0x2100)
+        return addr & 0xFF;
+    if ((addr & 0xFE00) == 0x4200)
+        return 0x100 + (addr & 0x1FF);
+    return -1;
 }
 
-uint16_t Bus::Read16(uint32_t addr)
+void DefineRegister(uint16_t addr, const char* name, uint8_t (*read)(uint16_t), void (*write)(uint16_t, uint8_t), uint8_t flags = 0, void (*write16)(uint16_t, uint16_t) = nullptr)
 {
-    uint8_t bank = (addr >> 16) & 0xff;
-    addr &= 0xFFFF;
+    registers[RegisterIndex(addr)] = {name, read, write, write16, flags};
+}
+
+void Unhandled(uint16_t addr, bool write, uint8_t data)
+{
+    int index = RegisterIndex(addr);
+    const char* name = index >= 0 && registers[index].name ? registers[index].name : "unknown";
 
-    switch (bank)
+    if (!unhandled[addr | write << 16]++)
     {
-    case 0x00 ... 0x3F:
+        if (write)
+            printf("[BUS]: Unhandled write of 0x%02x to 0x%04x (%s)\n", data, addr, name);
+        else
+            printf("[BUS]: Unhandled read from 0x%04x (%s)\n", addr, name);
+    }
+}
+
+void InitRegisters()
+{
+    DefineRegister(0x2100, "INIDISP", nullptr, [](uint16_t, uint8_t data) { PPU::WriteINIDISP(data); });
+    DefineRegister(0x2101, "OBSEL", nullptr, [](uint16_t, uint8_t data) { PPU::WriteOBSEL(data); });
+    DefineRegister(0x2102, "OAMADDL", nullptr, [](uint16_t, uint8_t data) { PPU::WriteOAMADDL(data); });
+    DefineRegister(0x2103, "OAMADDH", nullptr, [](uint16_t, uint8_t data) { PPU::WriteOAMADDH(data); });
+    DefineRegister(0x2104, "OAMDATA", nullptr, [](uint16_t, uint8_t data) { PPU::WriteOAMDATA(data); });
+    DefineRegister(0x2105, "BGMODE", nullptr, [](uint16_t, uint8_t data) { PPU::WriteBGMODE(data); });
+    for (uint16_t addr = 0x2107; addr <= 0x210A; addr++)
+        DefineRegister(addr, "BGnSC", nullptr, [](uint16_t addr, uint8_t data) { PPU::WriteBGTMAPSTART(addr - 0x2107, data); });
+    DefineRegister(0x2106, "MOSAIC", nullptr, nullptr, Ignored);
+    DefineRegister(0x210B, "BG12NBA", nullptr, [](uint16_t, uint8_t data) { PPU::WriteBGNBA(0, data); });
+    DefineRegister(0x210C, "BG34NBA", nullptr, [](uint16_t, uint8_t data) { PPU::WriteBGNBA(1, data); });
+    for (uint16_t addr = 0x210D; addr <= 0x2114; addr += 2)
     {
-        if (addr >= 0x8000)
-            return *(uint16_t*)&rom[(((bank&0x3F) << 15) | (addr & 0x7fff)) & (rom_size-1)];
-        if (addr < 0x2000)
-            return *(uint16_t*)&ram[addr];
-        
-        switch (addr)
-        {
-        case 0x4211:
-        {
-            uint16_t data = (timeup << 16) | hvbjoy;
-            timeup = 0;
-            return data;
-        }
-        case 0x4212:
-            return hvbjoy;
-        case 0x4218 ... 0x421F:
-            return 0;
-        case 0x2140:
-            return SPC700::ReadPort(0) | (SPC700::ReadPort(1) << 8);
-        }
-        
-        printf("Read16 from unknown addr 0x%02x:0x%04x\n", bank, addr);
-        exit(1);
+        DefineRegister(addr, "BGnHOFS", nullptr, [](uint16_t addr, uint8_t data) { PPU::WriteBGHOFS((addr - 0x210D) >> 1, data); });
+        DefineRegister(addr + 1, "BGnVOFS", nullptr, [](uint16_t addr, uint8_t data) { PPU::WriteBGVOFS((addr - 0x210E) >> 1, data); });
     }
-    case 0x40 ... 0x5F:
+    // BG1's scroll registers are mode 7's as well
+    DefineRegister(0x210D, "BG1HOFS", nullptr, [](uint16_t, uint8_t data) { PPU::WriteBGHOFS(0, data); PPU::WriteM7HOFS(data); });
+    DefineRegister(0x210E, "BG1VOFS", nullptr, [](uint16_t, uint8_t data) { PPU::WriteBGVOFS(0, data); PPU::WriteM7VOFS(data); });
+    DefineRegister(0x2115, "VMAIN", nullptr, [](uint16_t, uint8_t data) { PPU::WriteVMAIN(data); });
+    DefineRegister(0x2116, "VMADDL", nullptr, [](uint16_t, uint8_t data) { PPU::WriteVMADDL(data); },
+                   Wide, [](uint16_t, uint16_t data) { PPU::WriteVMADD(data); });
+    DefineRegister(0x2117, "VMADDH", nullptr, [](uint16_t, uint8_t data) { PPU::WriteVMADDH(data); });
+    // A 16-bit write stores the whole word and increments once, whatever VMAIN says
+    DefineRegister(0x2118, "VMDATAL", nullptr, [](uint16_t, uint8_t data) { PPU::WriteVMDATALow(data); },
+                   Wide, [](uint16_t, uint16_t data) { PPU::WriteVMDATA(data); });
+    DefineRegister(0x2119, "VMDATAH", nullptr, [](uint16_t, uint8_t data) { PPU::WriteVMDATAHi(data); });
+    DefineRegister(0x211A, "M7SEL", nullptr, [](uint16_t, uint8_t data) { PPU::WriteM7SEL(data); });
+    for (uint16_t addr = 0x211B; addr <= 0x2120; addr++)
+        DefineRegister(addr, "M7n", nullptr, [](uint16_t addr, uint8_t data) { PPU::WriteM7(addr - 0x211B, data); });
+    DefineRegister(0x2121, "CGADD", nullptr, [](uint16_t, uint8_t data) { PPU::WriteCGADD(data); });
+    DefineRegister(0x2122, "CGDATA", nullptr, [](uint16_t, uint8_t data) { PPU::WriteCGDATA(data); });
+    for (uint16_t addr = 0x2123; addr <= 0x2125; addr++)
+        DefineRegister(addr, "WnSEL", nullptr, [](uint16_t addr, uint8_t data) { PPU::WriteWSEL(addr - 0x2123, data); });
+    for (uint16_t addr = 0x2126; addr <= 0x2129; addr++)
+        DefineRegister(addr, "WHn", nullptr, [](uint16_t addr, uint8_t data) { PPU::WriteWH(addr - 0x2126, data); });
+    DefineRegister(0x212A, "WBGLOG", nullptr, [](uint16_t, uint8_t data) { PPU::WriteWBGLOG(data); });
+    DefineRegister(0x212B, "WOBJLOG", nullptr, [](uint16_t, uint8_t data) { PPU::WriteWOBJLOG(data); });
+    DefineRegister(0x212C, "TM", nullptr, [](uint16_t, uint8_t data) { PPU::WriteTM(data); });
+    DefineRegister(0x212D, "TS", nullptr, [](uint16_t, uint8_t data) { PPU::WriteTS(data); });
+    DefineRegister(0x212E, "TMW", nullptr, [](uint16_t, uint8_t data) { PPU::WriteTMW(data); });
+    DefineRegister(0x212F, "TSW", nullptr, [](uint16_t, uint8_t data) { PPU::WriteTSW(data); });
+    DefineRegister(0x2130, "CGWSEL", nullptr, [](uint16_t, uint8_t data) { PPU::WriteCGWSEL(data); });
+    DefineRegister(0x2131, "CGADSUB", nullptr, [](uint16_t, uint8_t data) { PPU::WriteCGADSUB(data); });
+    DefineRegister(0x2132, "COLDATA", nullptr, [](uint16_t, uint8_t data) { PPU::WriteCOLDATA(data); });
+    DefineRegister(0x2133, "SETINI", nullptr, [](uint16_t, uint8_t data) { PPU::WriteSETINI(data); });
+    for (uint16_t addr = 0x2134; addr <= 0x2136; addr++)
+        DefineRegister(addr, "MPYn", [](uint16_t addr) { return PPU::ReadMPY(addr - 0x2134); }, nullptr);
+    DefineRegister(0x2138, "RDOAM", [](uint16_t) { return PPU::ReadOAMDATA(); }, nullptr, ReadSteps);
+    DefineRegister(0x2139, "RDVRAML", [](uint16_t) { return PPU::ReadVMDATALow(); }, nullptr, ReadSteps);
+    DefineRegister(0x213A, "RDVRAMH", [](uint16_t) { return PPU::ReadVMDATAHi(); }, nullptr, ReadSteps);
+    DefineRegister(0x213E, "STAT77", [](uint16_t) { return PPU::ReadSTAT77(); }, nullptr);
+
+    DefineRegister(0x2180, "WMDATA", [](uint16_t) { return ram[wmadd++ & 0x1FFFF]; },
+                   [](uint16_t, uint8_t data) { WriteWMDATA(data); }, ReadSteps);
+    DefineRegister(0x2181, "WMADDL", nullptr, [](uint16_t, uint8_t data) { wmadd = (wmadd & 0x1FF00) | data; });
+    DefineRegister(0x2182, "WMADDM", nullptr, [](uint16_t, uint8_t data) { wmadd = (wmadd & 0x100FF) | (data << 8); });
+    DefineRegister(0x2183, "WMADDH", nullptr, [](uint16_t, uint8_t data) { wmadd = (wmadd & 0x0FFFF) | ((data & 1) << 16); });
+
+    // The four APU ports repeat up to $217F
+    for (uint16_t addr = 0x2140; addr <= 0x217F; addr++)
+        DefineRegister(addr, "APUIO", [](uint16_t addr) { return SPC700::ReadPort(addr & 0x3); },
+                       [](uint16_t addr, uint8_t data) { SPC700::WritePort(addr & 0x3, data); });
+
+    DefineRegister(0x4200, "NMITIMEN", nullptr, [](uint16_t, uint8_t data) { Interrupt::WriteNMITIMEN(data); });
+    DefineRegister(0x4202, "WRMPYA", nullptr, [](uint16_t, uint8_t data) { wrmpya = data; });
+    DefineRegister(0x4203, "WRMPYB", nullptr, [](uint16_t, uint8_t data) { rdmpy = wrmpya * data; rddiv = data; });
+    DefineRegister(0x4204, "WRDIVL", nullptr, [](uint16_t, uint8_t data) { wrdiv = (wrdiv & 0xFF00) | data; });
+    DefineRegister(0x4205, "WRDIVH", nullptr, [](uint16_t, uint8_t data) { wrdiv = (wrdiv & 0x00FF) | (data << 8); });
+    // Dividing by 0 gives $FFFF with the dividend as the remainder
+    DefineRegister(0x4206, "WRDIVB", nullptr, [](uint16_t, uint8_t data)
     {
-        return *(uint16_t*)&rom[(((bank&0x3F) * 0x10000) + addr) & (rom_size-1)];
+        rddiv = data ? wrdiv / data : 0xFFFF;
+        rdmpy = data ? wrdiv % data : wrdiv;
+    });
+    DefineRegister(0x4207, "HTIMEL", nullptr, [](uint16_t, uint8_t data) { Interrupt::WriteHTIMEL(data); });
+    DefineRegister(0x4208, "HTIMEH", nullptr, [](uint16_t, uint8_t data) { Interrupt::WriteHTIMEH(data); });
+    DefineRegister(0x4209, "VTIMEL", nullptr, [](uint16_t, uint8_t data) { Interrupt::WriteVTIMEL(data); });
+    DefineRegister(0x420A, "VTIMEH", nullptr, [](uint16_t, uint8_t data) { Interrupt::WriteVTIMEH(data); });
+    DefineRegister(0x420B, "MDMAEN", nullptr, [](uint16_t, uint8_t data) { HDMA::WriteMDMAEN(data); });
+    DefineRegister(0x420C, "HDMAEN", nullptr, [](uint16_t, uint8_t data) { HDMA::WriteHDMAEN(data); });
+    DefineRegister(0x420D, "MEMSEL", nullptr, [](uint16_t, uint8_t data) { memsel = data; });
+    DefineRegister(0x4210, "RDNMI", [](uint16_t) { return Interrupt::ReadRDNMI(); }, nullptr);
+    DefineRegister(0x4211, "TIMEUP", [](uint16_t) { return Interrupt::ReadTIMEUP(); }, nullptr);
+    DefineRegister(0x4212, "HVBJOY", [](uint16_t) { return hvbjoy; }, nullptr);
+    DefineRegister(0x4213, "RDIO", [](uint16_t) { return (uint8_t)0; }, nullptr);
+    DefineRegister(0x4214, "RDDIVL", [](uint16_t) { return (uint8_t)rddiv; }, nullptr);
+    DefineRegister(0x4215, "RDDIVH", [](uint16_t) { return (uint8_t)(rddiv >> 8); }, nullptr);
+    DefineRegister(0x4216, "RDMPYL", [](uint16_t) { return (uint8_t)rdmpy; }, nullptr);
+    DefineRegister(0x4217, "RDMPYH", [](uint16_t) { return (uint8_t)(rdmpy >> 8); }, nullptr);
+
+    // No controllers are plugged in
+    for (uint16_t addr = 0x4218; addr <= 0x421F; addr++)
+        DefineRegister(addr, "JOYn", [](uint16_t) { return (uint8_t)0; }, nullptr);
 
-        printf("Read8 from unknown addr 0x%02x:0x%04x\n", bank, addr);
-        exit(1);
+    // The DMA channels, $43x0-$43xB and $43xF
+    static const char* dma_names[16] = {"DMAPn", "BBADn", "A1TnL", "A1TnH", "A1Bn", "DASnL", "DASnH", "DASBn",
+                                        "A2AnL", "A2AnH", "NTRLn", "UNUSEDn", nullptr, nullptr, nullptr, "MIRRn"};
+    for (uint16_t addr = 0x4300; addr < 0x4380; addr++)
+    {
+        if (dma_names[addr & 0xF])
+            DefineRegister(addr, dma_names[addr & 0xF], [](uint16_t addr) { return HDMA::ReadReg(addr); },
+                           [](uint16_t addr, uint8_t data) { HDMA::WriteReg(addr, data); });
     }
-    case 0x7F:
-        return *(uint16_t*)&ram[0x10000 + (addr & 0xFFFF)];
-    default:
-        printf("Read16 from unknown bank 0x%02x\n", bank);
-        exit(1);
+}
+
+uint8_t IORead8(uint32_t full_addr)
+{
+    uint16_t addr = full_addr;
+
+    int index = RegisterIndex(addr);
+    if (index >= 0 && registers[index].read)
+    {
+        if (registers[index].flags & ReadSteps)
+            stepping_reads++;
+        return registers[index].read(addr);
     }
+
+    if (addr == 0x4016)
+        return 0;
+
+    Unhandled(addr, false, 0);
+    return 0;
 }
 
-uint8_t wrmpya, wrmpyb;
-uint16_t multiply_result;
+uint16_t IORead16(uint32_t full_addr)
+{
+    return IORead8(full_addr) | (IORead8((full_addr & 0xFF0000) | (uint16_t)(full_addr + 1)) << 8);
+}
 
-void Bus::Write8(uint32_t addr, uint8_t data)
+void IOWrite8(uint32_t full_addr, uint8_t data)
 {
-    uint8_t bank = (addr >> 16) & 0xff;
-    addr &= 0xFFFF;
+    uint16_t addr = full_addr;
 
-    switch (bank)
+    int index = RegisterIndex(addr);
+    if (index >= 0)
     {
-    case 0x00 ... 0x3F:
-    {
-        if (addr < 0x2000)
+        const Register& reg = registers[index];
+        if (reg.write)
         {
-            if (addr >= 0x04B0 && addr < 0x6B0)
-                printf("Writing 0x%02x to RGBData\n", data);
-            ram[addr] = data;
+            reg.write(addr, data);
             return;
         }
-
-        switch (addr)
-        {
-        case 0x2100:
-            PPU::WriteINIDISP(data);
-            return;
-        case 0x2105:
-            PPU::WriteBGMODE(data);
-            return;
-        case 0x2107:
-        case 0x2108:
-        case 0x2109:
-        case 0x210A:
-            PPU::WriteBGTMAPSTART(addr - 0x2107, data);
-            return;
-        case 0x210D:
-        case 0x210E:
-            return;
-        case 0x2115:
-            PPU::WriteVMAIN(data);
-            return;
-        case 0x2118:
-            PPU::WriteVMDATALow(data);
-            return;
-        case 0x2119:
-            PPU::WriteVMDATAHi(data);
-            return;
-        case 0x2121:
-            PPU::WriteCGADD(data);
-            return;
-        case 0x2122:
-            PPU::WriteCGDATA(data);
+        if (reg.flags & Ignored)
             return;
-        case 0x2132:
-            PPU::WriteCOLDATA(data);
-            return;
-        case 0x212C:
-        case 0x212D:
-        case 0x2130:
-        case 0x2131:
-        case 0x2133:
-            return;
-        case 0x2140:
-            SPC700::WritePort(0, data);
-            return;
-        case 0x2141:
-            SPC700::WritePort(1, data);
-            return;
-        case 0x4200:
-            printf("[BUS]: Writing 0x%02x to NMITIMEN\n", data);
-            nmitimen = data;
-            return;
-        case 0x4300:
-            HDMA::WriteDMAPx(0, data);
-            return;
-        case 0x4301:
-            HDMA::WriteBBADx(0, data);
-            return;
-        case 0x4304:
-            HDMA::WriteTblBank(0, data);
-            return;
-        case 0x4305:
-        case 0x4315:
-        case 0x4325:
-        case 0x4335:
-        case 0x4345:
-        case 0x4355:
-        case 0x4365:
-        case 0x4375:
-            HDMA::WriteDASxL((addr >> 4) & 0xf, data);
-            return;
-        case 0x420B:
-            HDMA::WriteMDMAEN(data);
-            return;
-        }
+    }
 
-        if (((addr & 0xFF00) == 0x4200) || ((addr & 0xFF00) == 0x2100))
-        {
-            if (data == 0)
-                return;
-            else
-            {
-                printf("Uh oh, actual data sent to 0x%04x\n", addr);
-                exit(1);
-            }
-        }
+    Unhandled(addr, true, data);
+}
 
-        printf("Write8 to unknown addr 0x%02x:0x%04x\n", bank, addr);
-        exit(1);
-    }
-    case 0x7f:
+void IOWrite16(uint32_t full_addr, uint16_t data)
+{
+    uint16_t addr = full_addr;
+
+    int index = RegisterIndex(addr);
+    if (index >= 0 && (registers[index].flags & Wide))
     {
-        ram[0x10000 + (addr&0xffff)] = data;
+        registers[index].write16(addr, data);
         return;
     }
-    default:
-        printf("Write8 to unknown bank 0x%02x\n", bank);
-        exit(1);
-    }
+
+    IOWrite8(full_addr, data);
+    IOWrite8((full_addr & 0xFF0000) | (uint16_t)(addr + 1), data >> 8);
 }
 
-void Bus::Write16(uint32_t addr, uint16_t data)
+struct Handlers
 {
-    uint8_t bank = (addr >> 16) & 0xff;
-    addr &= 0xFFFF;
+    uint8_t (*read8)(uint32_t addr);
+    uint16_t (*read16)(uint32_t addr);
+    void (*write8)(uint32_t addr, uint8_t data);
+    void (*write16)(uint32_t addr, uint16_t data);
+};
 
-    switch (bank)
-    {
-    case 0x00 ... 0x3F:
+// Indexed by Handler
+Handlers handlers[] =
+{
+    {UnmappedRead8, UnmappedRead16, UnmappedWrite8, UnmappedWrite16},
+    {IORead8, IORead16, IOWrite8, IOWrite16},
+};
+
+uint8_t Bus::Read8(uint32_t addr)
+{
+    const Page& page = pages[(addr >> PageBits) & (PageCount-1)];
+    if (page.read)
+        return page.read[addr & PageMask];
+    return handlers[page.handler].read8(addr);
+}
+
+uint16_t Bus::Read16(uint32_t addr)
+{
+    const Page& page = pages[(addr >> PageBits) & (PageCount-1)];
+    if ((addr & PageMask) != PageMask)
     {
-        if (addr < 0x2000)
+        if (page.read)
         {
-            if (addr >= 0x04B0 && addr < 0x6B0)
-                printf("Writing 0x%04x to RGBData\n", data);
-            *(uint16_t*)&ram[addr] = data;
-            return;
+            uint16_t data;
+            memcpy(&data, page.read + (addr & PageMask), 2);
+            return data;
         }
+        return handlers[page.handler].read16(addr);
+    }
 
-        switch (addr)
-        {
-        case 0x2116:
-            PPU::WriteVMADD(data);
-            return;
-        case 0x2118:
-            PPU::WriteVMDATA(data);
-            return;
-        case 0x212C:
-            return;
-        case 0x2140:
-            SPC700::WritePort(0, data);
-            SPC700::WritePort(1, data >> 8);
-            return;
-        case 0x2142:
-            SPC700::WritePort(2, data);
-            SPC700::WritePort(3, data >> 8);
-            return;
-        case 0x4305:
-        {
-            HDMA::WriteDASxL(0, data);
-            HDMA::WriteDASxH(0, data >> 8);
-            return;
-        }
-        case 0x4302:
-            HDMA::WriteTblStart(0, data);
-            return;
-        }
+    // Straddles two pages
+    return Read8(addr) | (Read8(addr + 1) << 8);
+}
+
+uint16_t Bus::Read16Bank(uint32_t addr)
+{
+    if ((addr & 0xFFFF) != 0xFFFF)
+        return Read16(addr);
+    return Read8(addr) | (Read8(addr & 0xFF0000) << 8);
+}
 
-        printf("Write16 to unknown addr 0x%02x:0x%04x\n", bank, addr);
-        exit(1);
+uint32_t Bus::Read24Bank(uint32_t addr)
+{
+    const Page& page = pages[(addr >> PageBits) & (PageCount-1)];
+    if ((addr & PageMask) < PageMask - 1 && page.read)
+    {
+        uint32_t data = 0;
+        memcpy(&data, page.read + (addr & PageMask), 3);
+        return data;
     }
-    case 0x7f:
+
+    // Crosses a page, the end of the bank or touches registers
+    uint32_t bank = addr & 0xFF0000;
+    return Read8(addr) | (Read8(bank | (uint16_t)(addr + 1)) << 8) | (Read8(bank | (uint16_t)(addr + 2)) << 16);
+}
+
+uint32_t Bus::ReadSpan(uint32_t addr, uint32_t max, const uint8_t*& src)
+{
+    const Page& page = pages[(addr >> PageBits) & (PageCount-1)];
+    if (!page.read)
+        return 0;
+
+    src = page.read + (addr & PageMask);
+    uint32_t length = PageMask + 1 - (addr & PageMask);
+
+    // Following pages of the bank that carry on in host memory
+    while (length < max && (addr & 0xFFFF) + length < 0x10000)
     {
-        *(uint16_t*)&ram[0x10000 + (addr&0xffff)] = data;
-        return;
+        const Page& next = pages[((addr + length) >> PageBits) & (PageCount-1)];
+        if (next.read != src + length)
+            break;
+        length += PageMask + 1;
     }
-    default:
-        printf("Write16 to unknown bank 0x%02x\n", bank);
-        exit(1);
+
+    return std::min(length, max);
+}
+
+void Bus::Write8(uint32_t addr, uint8_t data)
+{
+    const Page& page = pages[(addr >> PageBits) & (PageCount-1)];
+    if (page.write)
+    {
+        // Work RAM is the only host memory mapped for writing
+        page.write[addr & PageMask] = data;
+        Dirty::Mark(Dirty::WRAM, page.write + (addr & PageMask) - ram);
     }
-}
\ No newline at end of file
+    else
+        handlers[page.handler].write8(addr, data);
+}
+
+void Bus::Write16(uint32_t addr, uint16_t data)
+{
+    const Page& page = pages[(addr >> PageBits) & (PageCount-1)];
+    if ((addr & PageMask) != PageMask)
+    {
+        if (page.write)
+        {
+            memcpy(page.write + (addr & PageMask), &data, 2);
+            Dirty::Mark(Dirty::WRAM, page.write + (addr & PageMask) - ram);
+            Dirty::Mark(Dirty::WRAM, page.write + (addr & PageMask) + 1 - ram);
+        }
+        else
+            handlers[page.handler].write16(addr, data);
+        return;
+    }
+
+    Write8(addr, data);
+    Write8(addr + 1, data >> 8);
+}
@@ -10,10 +10,35 @@ void Dump();
 
 void SetVblank(bool set);
 
+bool IsRom(uint32_t addr);
+
+// Backed by WRAM, which can't be a DMA source for WMDATA
+bool IsWRAM(uint32_t addr);
+
+// $80-$BF:$8000-$FFFF and $C0-$FF, where MEMSEL can select 6 clock ROM access
+bool IsFastRegion(uint32_t addr);
+bool FastROM();
+
 uint8_t Read8(uint32_t addr);
 uint16_t Read16(uint32_t addr);
 
+// Operand, pointer and vector fetches stay inside their bank, wrapping
+// from $FFFF back to $0000 rather than carrying into the next one
+uint16_t Read16Bank(uint32_t addr);
+uint32_t Read24Bank(uint32_t addr);
+
 void Write8(uint32_t addr, uint8_t data);
 void Write16(uint32_t addr, uint16_t data);
 
+// Host memory behind addr in src, returns how many of the next max bytes
+// follow it contiguously in the same bank, 0 if addr isn't plain memory
+uint32_t ReadSpan(uint32_t addr, uint32_t max, const uint8_t*& src);
+
+// Count of reads so far from registers where reading steps an address
+// (WMDATA, RDOAM, RDVRAM), so the same read twice returns different data
+uint32_t SteppingReads();
+
+// Bulk write through WMDATA, fixed repeats src[0]
+void WriteWMDATASpan(const uint8_t* src, uint32_t bytes, bool fixed);
+
 }
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "cartridge.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Cartridge
+{
+
+uint8_t* data = nullptr;
+size_t size = 0;
+
+Layout layout = LoROM;
+uint8_t map_mode = 0;
+uint8_t chipset = 0;
+
+// Offsets of the header fields from the start of the header, $xFC0
+enum HeaderField
+{
+    Title = 0x00,       // 21 bytes
+    MapMode = 0x15,
+    Chipset = 0x16,
+    Complement = 0x1C,
+    Checksum = 0x1E,
+    ResetVector = 0x3C,
+};
+
+// How much the 64 bytes at offset look like a header for layout
+int Score(size_t offset, Layout layout)
+{
+    if (offset + 0x40 > size)
+        return -1;
+
+    const uint8_t* header = data + offset;
+    int score = 0;
+
+    static const uint8_t modes[] = {0x0, 0x1, 0x5};
+    if ((header[MapMode] & 0x0F) == modes[layout] && (header[MapMode] & 0xE0) == 0x20)
+        score += 2;
+
+    uint16_t complement = header[Complement] | (header[Complement+1] << 8);
+    uint16_t checksum = header[Checksum] | (header[Checksum+1] << 8);
+    if ((uint16_t)(checksum + complement) == 0xFFFF)
+        score += 4;
+
+    // Execution starts in the upper half of bank 0
+    if (header[ResetVector+1] & 0x80)
+        score++;
+
+    bool printable = true;
+    for (int i = 0; i < 21; i++)
+        printable &= isprint(header[Title + i]) != 0;
+    if (printable)
+        score++;
+
+    return score;
+}
+
+void Load(const char* name)
+{
+    int fd = open(name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || !st.st_size)
+    {
+        printf("[CART]: Couldn't open %s\n", name);
+        exit(1);
+    }
+
+    size = st.st_size;
+    void* file = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+    {
+        printf("[CART]: Couldn't map %s\n", name);
+        exit(1);
+    }
+
+    // ROM pages are never written through, see Bus::Init
+    data = (uint8_t*)file;
+
+    // Copier headers make the file 512 bytes longer than a multiple of 1K
+    if ((size & 0x3FF) == 0x200)
+    {
+        data += 0x200;
+        size -= 0x200;
+    }
+
+    static const size_t offsets[] = {0x7FC0, 0xFFC0, 0x40FFC0};
+
+    int best = -1;
+    for (int i = LoROM; i <= ExHiROM; i++)
+    {
+        int score = Score(offsets[i], (Layout)i);
+        if (score > best)
+        {
+            best = score;
+            layout = (Layout)i;
+        }
+    }
+
+    if (best >= 0)
+    {
+        map_mode = data[offsets[layout] + MapMode];
+        chipset = data[offsets[layout] + Chipset];
+    }
+
+    static const char* names[] = {"LoROM", "HiROM", "ExHiROM"};
+    printf("[CART]: %zu KB %s, map mode 0x%02x chipset 0x%02x\n", size / 1024, names[layout], map_mode, chipset);
+}
+
+uint8_t* Data()
+{
+    return data;
+}
+
+size_t Size()
+{
+    return size;
+}
+
+uint32_t Mirror(uint32_t offset)
+{
+    uint32_t base = 0;
+    uint32_t part = size;
+    uint32_t mask = 1 << 23;
+
+    while (offset >= part)
+    {
+        while (!(offset & mask))
+            mask >>= 1;
+        offset -= mask;
+        if (part > mask)
+        {
+            part -= mask;
+            base += mask;
+        }
+        mask >>= 1;
+    }
+
+    return base + offset;
+}
+
+Layout GetLayout()
+{
+    return layout;
+}
+
+bool HasSuperFX()
+{
+    return layout == LoROM && chipset >= 0x13 && chipset <= 0x1A;
+}
+
+}
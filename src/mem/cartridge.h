@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The ROM image and what its internal header says about it
+namespace Cartridge
+{
+
+enum Layout
+{
+    LoROM,
+    HiROM,
+    ExHiROM,
+};
+
+// Maps the image read-only, skipping a 512 byte copier header if there is
+// one, and picks the layout whose header location looks most like a real
+// header. The mapping is shared with every other process using the file.
+void Load(const char* name);
+
+uint8_t* Data();
+size_t Size();
+
+// Where a ROM offset lands on a cart whose size isn't a power of two. The
+// chips are a power of two part followed by a smaller one, which repeats
+// until it fills the next power of two, e.g. 3 MB reads as 2 MB + 1 MB + 1 MB.
+uint32_t Mirror(uint32_t offset);
+
+Layout GetLayout();
+bool HasSuperFX();      // GSU carts also see ROM linearly at $40-$5F
+
+}
@@ -0,0 +1,115 @@
+#include "dirty.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Dirty
+{
+
+static uint64_t wram_bits[512 / 64];
+static uint64_t vram_bits[256 / 64];
+static uint64_t cgram_bits[1];
+static uint64_t aram_bits[256 / 64];
+
+// Indexed by Region
+Map maps[RegionCount] =
+{
+    {wram_bits, 512, 8, 0, nullptr},
+    {vram_bits, 256, 8, 0, nullptr},
+    {cgram_bits, 16, 5, 0, nullptr},
+    {aram_bits, 256, 8, 0, nullptr},
+};
+
+struct Consumer
+{
+    Region region;
+    bool active;
+    std::vector<uint64_t> bits;     // Pages written since its last Snapshot
+};
+
+// Indexed by the id AddConsumer returned, slots are reused
+static std::vector<Consumer> consumers;
+
+static size_t Words(const Map& map)
+{
+    return (map.pages + 63) / 64;
+}
+
+// Hands the pages marked since the last sync to every consumer of region
+static void Sync(Region region)
+{
+    Map& map = maps[region];
+    for (Consumer& c : consumers)
+    {
+        if (c.active && c.region == region)
+        {
+            for (size_t i = 0; i < c.bits.size(); i++)
+                c.bits[i] |= map.bits[i];
+        }
+    }
+    memset(map.bits, 0, Words(map) * sizeof(uint64_t));
+}
+
+int AddConsumer(Region region)
+{
+    Map& map = maps[region];
+
+    // Pending pages go to the consumers already there. Without any, the
+    // bitmap is whatever was left from the last time someone tracked it.
+    Sync(region);
+    map.consumers++;
+
+    size_t id = 0;
+    while (id < consumers.size() && consumers[id].active)
+        id++;
+    if (id == consumers.size())
+        consumers.emplace_back();
+
+    Consumer& c = consumers[id];
+    c.region = region;
+    c.active = true;
+    c.bits.assign(Words(map), ~0ull);
+    if (map.pages % 64)
+        c.bits.back() = (1ull << (map.pages % 64)) - 1;
+    return id;
+}
+
+void RemoveConsumer(int consumer)
+{
+    Consumer& c = consumers[consumer];
+    if (c.active)
+    {
+        c.active = false;
+        maps[c.region].consumers--;
+    }
+}
+
+uint32_t PageCount(Region region)
+{
+    return maps[region].pages;
+}
+
+uint32_t PageSize(Region region)
+{
+    return 1u << maps[region].page_bits;
+}
+
+void SetMemory(Region region, const uint8_t* data)
+{
+    maps[region].data = data;
+}
+
+const uint8_t* Memory(Region region)
+{
+    return maps[region].data;
+}
+
+void Snapshot(int consumer, std::vector<uint64_t>& out)
+{
+    Consumer& c = consumers[consumer];
+    Sync(c.region);
+    out = c.bits;
+    std::fill(c.bits.begin(), c.bits.end(), 0);
+}
+
+}
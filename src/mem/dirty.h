@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Per-page dirty bitmaps for the memories that change between frames, for
+// savestates, renderer caches and RAM diffs. Write paths mark the page they
+// touched in one bitmap per memory, but only while a consumer has
+// registered for it. Each consumer keeps its own record of what it hasn't
+// seen yet, which the shared bitmap is folded into on every Snapshot.
+namespace Dirty
+{
+
+enum Region
+{
+    WRAM,   // 128 KB, 256 byte pages
+    VRAM,   // 64 KB, 256 byte pages
+    CGRAM,  // 512 bytes, one page per 16 color palette
+    ARAM,   // The SPC700's 64 KB, 256 byte pages
+    RegionCount,
+};
+
+struct Map
+{
+    uint64_t* bits;         // Pages written since the consumers last synced
+    uint32_t pages;
+    uint8_t page_bits;
+    int consumers;
+    const uint8_t* data;    // The memory itself, set by its owner
+};
+
+extern Map maps[RegionCount];
+
+// Registers a consumer of region. Its first Snapshot has every page marked,
+// since it has seen none of them.
+int AddConsumer(Region region);
+void RemoveConsumer(int consumer);
+
+uint32_t PageCount(Region region);
+uint32_t PageSize(Region region);
+
+void SetMemory(Region region, const uint8_t* data);
+const uint8_t* Memory(Region region);
+
+// The pages written since this consumer's last Snapshot into out, bit n for
+// page n. Other consumers of the region still get them on their next one.
+void Snapshot(int consumer, std::vector<uint64_t>& out);
+
+inline void Mark(Region region, uint32_t offset)
+{
+    Map& map = maps[region];
+    if (map.consumers)
+    {
+        uint32_t page = offset >> map.page_bits;
+        map.bits[page >> 6] |= 1ull << (page & 63);
+    }
+}
+
+// Bulk writes, length bytes from offset
+inline void MarkRange(Region region, uint32_t offset, uint32_t length)
+{
+    Map& map = maps[region];
+    if (map.consumers && length)
+    {
+        for (uint32_t page = offset >> map.page_bits; page <= (offset + length - 1) >> map.page_bits; page++)
+            map.bits[page >> 6] |= 1ull << (page & 63);
+    }
+}
+
+}
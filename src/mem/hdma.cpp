@@ -2,105 +2,423 @@
 
 #include <cstdlib>
 #include <cstdio>
-#include <cassert>
+#include <map>
+#include <vector>
 
 #include "Bus.h"
+#include "../ppu/ppu.h"
 
 struct Channel
 {
-    uint16_t byteCount = 0;
-    uint32_t startAddr = 0;
-    uint8_t dmap = 0;
-    uint8_t bbus;
+    uint8_t dmap = 0xFF;        // $43x0, direction, step and transfer mode
+    uint8_t bbad = 0xFF;        // $43x1, B-bus register, $21xx
+    uint16_t a1t = 0xFFFF;      // $43x2/3, A-bus address
+    uint8_t a1b = 0xFF;         // $43x4, A-bus bank
+    uint16_t das = 0xFFFF;      // $43x5/6, byte count, 0 is 64 KB
+    uint8_t dasb = 0xFF;        // $43x7
+    uint16_t a2a = 0xFFFF;      // $43x8/9
+    uint8_t ntrl = 0xFF;        // $43xA
+    uint8_t unused = 0xFF;      // $43xB, mirrored at $43xF
+
+    // HDMA state, the channel is on for the rest of the frame while active
+    bool active = false;
+    bool do_transfer = false;
+    const struct CompiledTable* table = nullptr;
 } chans[8];
 
-void HDMA::WriteDASxL(int chan, uint8_t data)
+// A whole frame of an HDMA table that lives in ROM, worked out once. Each
+// line holds the unit to write, if any, and the channel state after it.
+struct CompiledLine
+{
+    int32_t unit;       // Offset into data, -1 for no transfer
+    uint16_t a2a;
+    uint16_t das;
+    uint8_t ntrl;
+    uint8_t clocks;
+    bool active;
+    bool do_transfer;
+};
+
+struct CompiledTable
+{
+    bool usable;        // False if the walk touched anything but ROM
+    CompiledLine start;
+    CompiledLine lines[225];
+    std::vector<uint8_t> data;
+};
+
+// Keyed by table address, DMAPx and the indirect bank
+std::map<uint64_t, CompiledTable> compiled;
+
+uint8_t hdmaen = 0;
+int stall = 0;
+
+// B-bus register offsets for each byte of a transfer unit, by DMAPx mode
+static const uint8_t patterns[8][4] =
+{
+    {0, 0, 0, 0},
+    {0, 1, 0, 1},
+    {0, 0, 0, 0},
+    {0, 0, 1, 1},
+    {0, 1, 2, 3},
+    {0, 1, 0, 1},
+    {0, 0, 0, 0},
+    {0, 0, 1, 1},
+};
+
+// Bytes per HDMA transfer unit, by DMAPx mode
+static const uint8_t unit_sizes[8] = {1, 2, 2, 4, 4, 4, 2, 4};
+
+#define printf(x, ...) 0
+
+uint8_t HDMA::ReadReg(uint16_t addr)
 {
-    printf("Writing %x to DASxL\n", data);
-    chans[chan].byteCount &= ~0xFF;
-    chans[chan].byteCount |= data;
+    Channel& c = chans[(addr >> 4) & 0x7];
+    switch (addr & 0xF)
+    {
+    case 0x0: return c.dmap;
+    case 0x1: return c.bbad;
+    case 0x2: return c.a1t;
+    case 0x3: return c.a1t >> 8;
+    case 0x4: return c.a1b;
+    case 0x5: return c.das;
+    case 0x6: return c.das >> 8;
+    case 0x7: return c.dasb;
+    case 0x8: return c.a2a;
+    case 0x9: return c.a2a >> 8;
+    case 0xA: return c.ntrl;
+    case 0xB: case 0xF: return c.unused;
+    }
+    return 0;
 }
 
-void HDMA::WriteDASxH(int chan, uint8_t data)
+void HDMA::WriteReg(uint16_t addr, uint8_t data)
 {
-    printf("Writing %x to DASxH\n", data);
-    chans[chan].byteCount &= 0xFF;
-    chans[chan].byteCount |= (data << 8);
+    Channel& c = chans[(addr >> 4) & 0x7];
+    switch (addr & 0xF)
+    {
+    case 0x0: c.dmap = data; break;
+    case 0x1: c.bbad = data; break;
+    case 0x2: c.a1t = (c.a1t & 0xFF00) | data; break;
+    case 0x3: c.a1t = (c.a1t & 0x00FF) | (data << 8); break;
+    case 0x4: c.a1b = data; break;
+    case 0x5: c.das = (c.das & 0xFF00) | data; break;
+    case 0x6: c.das = (c.das & 0x00FF) | (data << 8); break;
+    case 0x7: c.dasb = data; break;
+    case 0x8: c.a2a = (c.a2a & 0xFF00) | data; break;
+    case 0x9: c.a2a = (c.a2a & 0x00FF) | (data << 8); break;
+    case 0xA: c.ntrl = data; break;
+    case 0xB: case 0xF: c.unused = data; break;
+    }
+}
+
+// Moves what it can of an A to B transfer with bulk copies, from memory
+// straight into VRAM, CGRAM or WRAM. Returns the bytes done, the caller
+// carries on a byte at a time from there.
+static uint32_t TransferSpans(Channel& c, uint32_t count)
+{
+    uint8_t mode = c.dmap & 0x7;
+    bool fixed = c.dmap & 0x08;
+    bool single = patterns[mode][1] == 0 && patterns[mode][3] == 0;
+
+    // Where the bytes end up, one register or the VMDATA pair
+    enum { None, VRAM, CGRAM, OAM, WRAM } target = None;
+    if ((mode == 1 || mode == 5) && c.bbad == 0x18 && PPU::CanWriteVRAMSpan())
+        target = VRAM;
+    else if (single && c.bbad == 0x22)
+        target = CGRAM;
+    else if (single && c.bbad == 0x04)
+        target = OAM;
+    else if (single && c.bbad == 0x80)
+        target = WRAM;
+
+    if (target == None || (c.dmap & 0x80) || (c.dmap & 0x18) == 0x10)
+        return 0;
+
+    uint32_t done = 0;
+    while (done < count)
+    {
+        // WRAM to WMDATA writes nothing, leave it to the byte loop
+        uint32_t a = c.a1b << 16 | c.a1t;
+        if (target == WRAM && Bus::IsWRAM(a))
+            break;
+
+        const uint8_t* src;
+        uint32_t n = Bus::ReadSpan(a, count - done, src);
+        if (!n)
+            break;
+        if (fixed)
+            n = count - done;
+
+        switch (target)
+        {
+        case VRAM:
+            // Whole words only, a lone byte goes the slow way
+            n &= ~1u;
+            if (!n)
+                return done;
+            PPU::WriteVRAMSpan(src, n >> 1, fixed);
+            break;
+        case CGRAM:
+            PPU::WriteCGRAMSpan(src, n, fixed);
+            break;
+        case OAM:
+            PPU::WriteOAMSpan(src, n, fixed);
+            break;
+        default:
+            Bus::WriteWMDATASpan(src, n, fixed);
+            break;
+        }
+
+        if (!fixed)
+            c.a1t += n;
+        done += n;
+    }
+
+    return done;
 }
 
-void HDMA::WriteTblStart(int chan, uint16_t data)
+// Returns the bytes moved
+static uint32_t Transfer(int chan)
 {
-    chans[chan].startAddr &= ~0xFFFF;
-    chans[chan].startAddr |= data;
+    Channel& c = chans[chan];
+    uint32_t count = c.das ? c.das : 0x10000;
+    uint8_t mode = c.dmap & 0x7;
+
+    printf("[HDMA]: Channel %d transferring %d bytes (dmap %02x reg %x from %06x)\n", chan, count, c.dmap, c.bbad, c.a1b << 16 | c.a1t);
+
+    uint32_t i = TransferSpans(c, count);
+
+    // Fixed, increment or decrement, only the low 16 bits move
+    int step = (c.dmap & 0x08) ? 0 : (c.dmap & 0x10) ? -1 : 1;
+    for (; i < count; i++)
+    {
+        uint32_t a = c.a1b << 16 | c.a1t;
+        uint16_t b = 0x2100 | (uint8_t)(c.bbad + patterns[mode][i & 3]);
+
+        // The A and B bus can't both be WRAM, nothing is written
+        if (b != 0x2180 || !Bus::IsWRAM(a))
+        {
+            if (c.dmap & 0x80)
+                Bus::Write8(a, Bus::Read8(b));
+            else
+                Bus::Write8(b, Bus::Read8(a));
+        }
+
+        c.a1t += step;
+    }
+
+    c.das = 0;
+    return count;
 }
 
-void HDMA::WriteTblBank(int chan, uint8_t data)
+bool HDMA::Stalling()
 {
-    chans[chan].startAddr &= 0xFFFF;
-    chans[chan].startAddr |= ((uint32_t)data << 16);
+    return stall != 0;
 }
 
-void HDMA::WriteDMAPx(int chan, uint8_t data)
+int HDMA::TakeStall()
 {
-    chans[chan].dmap = data;
+    int clocks = stall;
+    stall = 0;
+    return clocks;
 }
 
-void HDMA::WriteBBADx(int chan, uint8_t data)
+// Reads the next table entry, its line count and for indirect tables the
+// data address. Returns the master clocks it took.
+template<typename Reader>
+static int LoadEntry(Channel& c, Reader read)
 {
-    chans[chan].bbus = data;
+    int clocks = 8;
+    c.ntrl = read(c.a1b << 16 | c.a2a);
+    c.a2a++;
+    if (c.dmap & 0x40)
+    {
+        c.das = read(c.a1b << 16 | c.a2a);
+        c.das |= read(c.a1b << 16 | (uint16_t)(c.a2a + 1)) << 8;
+        c.a2a += 2;
+        clocks += 16;
+    }
+
+    c.active = c.ntrl != 0;
+    c.do_transfer = true;
+    return clocks;
 }
 
-void HDMA::WriteMDMAEN(uint8_t data)
+// One scanline of an active channel, unit(i, addr) moves byte i of the unit
+template<typename Reader, typename Unit>
+static int StepLine(Channel& c, Reader read, Unit unit)
 {
-    if (!data)
-        return;
+    int clocks = 8;
+    if (c.do_transfer)
+    {
+        for (int i = 0; i < unit_sizes[c.dmap & 0x7]; i++)
+        {
+            if (c.dmap & 0x40)
+                unit(i, c.dasb << 16 | c.das++);
+            else
+                unit(i, c.a1b << 16 | c.a2a++);
+            clocks += 8;
+        }
+    }
+
+    c.ntrl--;
+    c.do_transfer = c.ntrl & 0x80;
+    if (!(c.ntrl & 0x7F))
+        clocks += LoadEntry(c, read);
+    return clocks;
+}
+
+// Walks a table through the whole frame ahead of time. Only worth it, and
+// only correct, when everything it reads is ROM and can't change.
+static const CompiledTable* Compile(const Channel& chan)
+{
+    if (chan.dmap & 0x80)
+        return nullptr;
+
+    uint64_t key = (uint64_t)chan.a1b << 16 | chan.a1t | (uint64_t)chan.dmap << 24 | (uint64_t)chan.dasb << 32;
+    auto found = compiled.find(key);
+    if (found != compiled.end())
+        return found->second.usable ? &found->second : nullptr;
+
+    CompiledTable& t = compiled[key];
+    t.usable = true;
+
+    auto read = [&](uint32_t addr) -> uint8_t
+    {
+        if (!Bus::IsRom(addr))
+            t.usable = false;
+        return Bus::Read8(addr);
+    };
 
-    if (data != 0x1)
+    auto save = [](CompiledLine& l, const Channel& c)
     {
-        printf("TODO: Channels other than 1 being started (0x%02x)\n", data);
-        exit(1);
+        l.a2a = c.a2a;
+        l.das = c.das;
+        l.ntrl = c.ntrl;
+        l.active = c.active;
+        l.do_transfer = c.do_transfer;
+    };
+
+    Channel c = chan;
+    c.a2a = c.a1t;
+    t.start.unit = -1;
+    t.start.clocks = LoadEntry(c, read);
+    save(t.start, c);
+
+    for (int line = 0; line < 225; line++)
+    {
+        CompiledLine& l = t.lines[line];
+        l.unit = -1;
+        l.clocks = 0;
+        if (c.active)
+        {
+            if (c.do_transfer)
+                l.unit = t.data.size();
+            l.clocks = StepLine(c, read, [&](int, uint32_t addr) { t.data.push_back(read(addr)); });
+        }
+        save(l, c);
     }
 
-    auto& c = chans[0];
-#define printf(x, ...) 0
-    printf("[HDMA]: Transferring %d bytes (step %d reg %x type %d)\n", c.byteCount, (c.dmap >> 3) & 3, c.bbus, c.dmap & 0x7);
+    printf("[HDMA]: Compiled table at %06x (%s)\n", chan.a1b << 16 | chan.a1t, t.usable ? "ROM" : "not ROM");
+    return t.usable ? &t : nullptr;
+}
 
-    uint8_t step = (c.dmap >> 3) & 3;
+static int Restore(Channel& c, const CompiledLine& l)
+{
+    c.a2a = l.a2a;
+    c.das = l.das;
+    c.ntrl = l.ntrl;
+    c.active = l.active;
+    c.do_transfer = l.do_transfer;
+    return l.clocks;
+}
+
+void HDMA::WriteHDMAEN(uint8_t data)
+{
+    hdmaen = data;
+}
 
-    assert((c.byteCount % 2) == 0);
+void HDMA::StartFrame()
+{
+    if (!hdmaen)
+        return;
 
-    if ((c.dmap & 0x7) == 1)
+    stall += 18;
+    for (int chan = 0; chan < 8; chan++)
     {
-        while (c.byteCount)
+        Channel& c = chans[chan];
+        c.active = false;
+        if (!(hdmaen & (1 << chan)))
+            continue;
+
+        c.table = Compile(c);
+        if (c.table)
+            stall += Restore(c, c.table->start);
+        else
         {
-            printf("[HDMA]: Reading from 0x%04x\n", c.startAddr);
-            uint16_t data = Bus::Read16(c.startAddr);
-            if (step == 0)
-                c.startAddr = (c.startAddr & 0xFF0000) | ((uint16_t)(c.startAddr & 0xFFFF) + 2);
-            else if (step == 2)
-                c.startAddr = (c.startAddr & 0xFF0000) | ((uint16_t)(c.startAddr & 0xFFFF) - 2);
-
-            Bus::Write16(0x2100 + c.bbus, data);
-            c.byteCount -= 2;
+            c.a2a = c.a1t;
+            stall += LoadEntry(c, Bus::Read8);
         }
     }
-    else if ((c.dmap & 0x7) == 2)
+}
+
+void HDMA::RunLine(int line)
+{
+    if (!hdmaen)
+        return;
+
+    bool any = false;
+    for (int chan = 0; chan < 8; chan++)
     {
-        while (c.byteCount)
+        Channel& c = chans[chan];
+        if (!c.active || !(hdmaen & (1 << chan)))
+            continue;
+
+        any = true;
+        uint8_t mode = c.dmap & 0x7;
+
+        if (c.table)
         {
-            uint16_t data = Bus::Read16(c.startAddr);
-            if (step == 0)
-                c.startAddr = (c.startAddr & 0xFF0000) | ((uint16_t)(c.startAddr & 0xFFFF) + 2);
-            else if (step == 2)
-                c.startAddr = (c.startAddr & 0xFF0000) | ((uint16_t)(c.startAddr & 0xFFFF) - 2);
-
-            Bus::Write8(0x2100 + c.bbus, data >> 8);
-            Bus::Write8(0x2100 + c.bbus, data);
-            c.byteCount -= 2;
+            const CompiledLine& l = c.table->lines[line];
+            if (l.unit >= 0)
+            {
+                const uint8_t* unit = &c.table->data[l.unit];
+                for (int i = 0; i < unit_sizes[mode]; i++)
+                    Bus::Write8(0x2100 | (uint8_t)(c.bbad + patterns[mode][i]), unit[i]);
+            }
+
+            stall += Restore(c, l);
+            continue;
         }
+
+        stall += StepLine(c, Bus::Read8, [&](int i, uint32_t addr)
+        {
+            uint16_t b = 0x2100 | (uint8_t)(c.bbad + patterns[mode][i]);
+            if (c.dmap & 0x80)
+                Bus::Write8(addr, Bus::Read8(b));
+            else
+                Bus::Write8(b, Bus::Read8(addr));
+        });
     }
-    else
+
+    if (any)
+        stall += 18;
+}
+
+void HDMA::WriteMDMAEN(uint8_t data)
+{
+    if (!data)
+        return;
+
+    // 8 master clocks per byte and per channel, plus getting in step with
+    // the CPU clock, which takes 12-24
+    int clocks = 18;
+    for (int chan = 0; chan < 8; chan++)
     {
-        assert(0);
+        if (data & (1 << chan))
+            clocks += 8 + 8 * Transfer(chan);
     }
+
+    stall += clocks;
 }
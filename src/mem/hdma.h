@@ -6,15 +6,22 @@
 namespace HDMA
 {
 
-void WriteDASxL(int chan, uint8_t data);
-void WriteDASxH(int chan, uint8_t data);
+// The channel registers at $4300-$437F
+uint8_t ReadReg(uint16_t addr);
+void WriteReg(uint16_t addr, uint8_t data);
 
-void WriteTblStart(int chan, uint16_t data);
-void WriteTblBank(int chan, uint8_t data);
+void WriteMDMAEN(uint8_t data);
+void WriteHDMAEN(uint8_t data);
 
-void WriteDMAPx(int chan, uint8_t data);
-void WriteBBADx(int chan, uint8_t data);
+// Called by the PPU, at the top of the frame and at the end of each
+// visible scanline 0-224
+void StartFrame();
+void RunLine(int line);
 
-void WriteMDMAEN(uint8_t data);
+// Master clocks the CPU has lost to DMA and HDMA since the last call. The
+// CPU stops as soon as Stalling says so, and the rest of the system runs on
+// for that long in one go.
+bool Stalling();
+int TakeStall();
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,218 @@
+// Background layers for modes 0-6. Every mode and layer pair gets its own
+// instantiation of RenderLayer, so bit depth, palette layout and hires
+// sampling are fixed at compile time and the inner loops only deal with
+// pixels. Mode 7 has its own renderer.
+
+#include "ppu.h"
+#include "render.h"
+#include "tile_cache.h"
+#include <cstring>
+
+uint8_t bg_tmap_start[4];       // BGnSC: map base in 1K word units << 2 | size
+uint8_t bg_char_base[4];        // BG12NBA/BG34NBA nibbles, 4K word units
+uint16_t bg_hofs[4], bg_vofs[4];
+uint8_t bgofs_latch, bghofs_latch;
+
+namespace
+{
+
+// Bits per pixel of each layer per mode, 0 where the layer doesn't exist
+constexpr int LayerBpp(int mode, int layer)
+{
+    constexpr int bpp[7][4] =
+    {
+        {2, 2, 2, 2},
+        {4, 4, 2, 0},
+        {4, 4, 0, 0},
+        {8, 4, 0, 0},
+        {8, 2, 0, 0},
+        {4, 2, 0, 0},
+        {4, 0, 0, 0},
+    };
+    return bpp[mode][layer];
+}
+
+constexpr TileCache::Format FormatFor(int bpp)
+{
+    return bpp == 2 ? TileCache::Bpp2 : bpp == 4 ? TileCache::Bpp4 : TileCache::Bpp8;
+}
+
+// VRAM byte address of the map entry for tile column tx, row ty. Maps are
+// one to four 32x32 screens, laid out left to right then top to bottom.
+inline uint32_t MapAddress(uint8_t sc, int tx, int ty)
+{
+    uint32_t addr = ((sc & 0xFC) << 9) + ((ty & 31) * 32 + (tx & 31)) * 2;
+    if ((tx & 32) && (sc & 1))
+        addr += 0x800;
+    if ((ty & 32) && (sc & 2))
+        addr += (sc & 1) ? 0x1000 : 0x800;
+    return addr & 0xFFFF;
+}
+
+template<int Mode, int Layer>
+void RenderLayer(int y, uint16_t* out)
+{
+    constexpr int bpp = LayerBpp(Mode, Layer);
+    constexpr TileCache::Format format = FormatFor(bpp);
+    constexpr uint32_t tile_bytes = 8 * bpp;
+    // Modes 5 and 6 are 512 pixels wide, we keep every other one
+    constexpr bool hires = Mode == 5 || Mode == 6;
+    // Mode 0 gives each layer its own 32 colours
+    constexpr int palette_base = Mode == 0 ? Layer * 32 : 0;
+
+    const PPU::Depths& depths = PPU::CurrentDepths();
+    const uint16_t depth[2] = {(uint16_t)(depths.bg[Layer][0] << 8), (uint16_t)(depths.bg[Layer][1] << 8)};
+
+    uint8_t sc = bg_tmap_start[Layer];
+    uint32_t char_base = bg_char_base[Layer] << 13;
+    bool large = bgmode & (0x10 << Layer);
+    int tile_h_bits = large ? 4 : 3;
+    int tile_w_bits = large || hires ? 4 : 3;
+
+    int vy = (y + bg_vofs[Layer]) & 0x3FF;
+    int ty = vy >> tile_h_bits;
+    int row = vy & 7;
+    bool bottom = large && (vy & 8);
+
+    // Tiles are drawn whole into a line with a tile of slack on each side,
+    // so a partly scrolled in tile needs no clipping
+    uint16_t padded[16 + 256 + 16];
+
+    // Columns of 8 output pixels, one 8x8 tile or half a hires 16x8 one
+    int hofs = bg_hofs[Layer];
+    int shift = hires ? 4 : 3;
+    int fine = hires ? (hofs & 15) >> 1 : hofs & 7;
+    int first = hofs >> shift;
+
+    for (int col = 0; col <= 32; col++)
+    {
+        int px = (first + col) << shift;                // layer x of the column, in its own pixels
+        int tx = px >> tile_w_bits;
+        uint32_t map = MapAddress(sc, tx, ty);
+        uint16_t entry = vram[map] | (vram[map + 1] << 8);
+
+        bool hflip = entry & 0x4000;
+        bool vflip = entry & 0x8000;
+        uint16_t d = depth[(entry >> 13) & 1];
+        uint16_t palette = palette_base + (bpp == 8 ? 0 : ((entry >> 10) & 7) << bpp);
+
+        // Which 8x8 quarter of a 16x16 tile, mirrored by the flips
+        int sub_x = large && !hires ? (px >> 3) & 1 : 0;
+        int sub_y = bottom ? 1 : 0;
+        if (hflip && large && !hires)
+            sub_x ^= 1;
+        if (vflip && large)
+            sub_y ^= 1;
+        int tile_row = vflip ? 7 - row : row;
+
+        uint32_t tile = (entry & 0x3FF) + sub_x + sub_y * 16;
+        uint16_t* dst = &padded[16 + col*8 - fine];
+
+        uint8_t pixels[16];
+        if (hires)
+        {
+            // Both halves of the 16 pixel row, then every other pixel of it
+            uint8_t wide[16];
+            const uint8_t* left = TileCache::Get(format, (char_base + (tile & 0x3FF) * tile_bytes) & 0xFFFF) + tile_row*8;
+            const uint8_t* right = TileCache::Get(format, (char_base + ((tile + 1) & 0x3FF) * tile_bytes) & 0xFFFF) + tile_row*8;
+            if (hflip)
+            {
+                for (int i = 0; i < 8; i++)
+                {
+                    wide[i] = right[7 - i];
+                    wide[8 + i] = left[7 - i];
+                }
+            }
+            else
+            {
+                memcpy(wide, left, 8);
+                memcpy(wide + 8, right, 8);
+            }
+            for (int i = 0; i < 8; i++)
+                pixels[i] = wide[i*2];
+        }
+        else
+        {
+            const uint8_t* src = TileCache::Get(format, (char_base + (tile & 0x3FF) * tile_bytes) & 0xFFFF) + tile_row*8;
+            if (hflip)
+            {
+                for (int i = 0; i < 8; i++)
+                    pixels[i] = src[7 - i];
+            }
+            else
+                memcpy(pixels, src, 8);
+        }
+
+        for (int i = 0; i < 8; i++)
+            dst[i] = pixels[i] ? (d | (palette + pixels[i])) : 0;
+    }
+
+    memcpy(out, &padded[16], 256 * sizeof(uint16_t));
+}
+
+typedef void (*LayerFunc)(int y, uint16_t* out);
+
+template<int Mode, int Layer>
+constexpr LayerFunc Entry()
+{
+    if constexpr (LayerBpp(Mode, Layer) != 0)
+        return &RenderLayer<Mode, Layer>;
+    else
+        return nullptr;
+}
+
+template<int Mode>
+constexpr LayerFunc layers_for[4] = {Entry<Mode, 0>(), Entry<Mode, 1>(), Entry<Mode, 2>(), Entry<Mode, 3>()};
+
+const LayerFunc* const layer_funcs[7] =
+{
+    layers_for<0>, layers_for<1>, layers_for<2>, layers_for<3>,
+    layers_for<4>, layers_for<5>, layers_for<6>,
+};
+
+}
+
+uint8_t PPU::RenderBackgrounds(int y, uint8_t mask, uint16_t out[4][256])
+{
+    int mode = bgmode & 7;
+    if (mode == 7)
+        return RenderMode7(y, mask, out);
+
+    uint8_t drawn = 0;
+    for (int layer = 0; layer < 4; layer++)
+    {
+        if ((mask & (1 << layer)) && layer_funcs[mode][layer])
+        {
+            layer_funcs[mode][layer](y, out[layer]);
+            drawn |= 1 << layer;
+        }
+    }
+    return drawn;
+}
+
+void PPU::WriteBGTMAPSTART(int index, uint8_t data)
+{
+    bg_tmap_start[index] = data;
+}
+
+void PPU::WriteBGNBA(int index, uint8_t data)
+{
+    bg_char_base[index*2] = data & 0xF;
+    bg_char_base[index*2 + 1] = data >> 4;
+}
+
+// Scroll registers are written twice, low byte first, through a latch the
+// eight of them share. Horizontal ones take their low three bits from a
+// second latch that only HOFS writes update.
+void PPU::WriteBGHOFS(int layer, uint8_t data)
+{
+    bg_hofs[layer] = ((data << 8) | (bgofs_latch & ~7) | (bghofs_latch & 7)) & 0x3FF;
+    bgofs_latch = data;
+    bghofs_latch = data;
+}
+
+void PPU::WriteBGVOFS(int layer, uint8_t data)
+{
+    bg_vofs[layer] = ((data << 8) | bgofs_latch) & 0x3FF;
+    bgofs_latch = data;
+}
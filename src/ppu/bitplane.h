@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Turns one 8 pixel row of a planar tile into palette indices, leftmost
+// pixel first. row points at the row's first pair of bitplanes in VRAM, the
+// planes after it come in interleaved pairs 16 bytes apart, so 2bpp reads
+// row[0-1], 4bpp adds row[16-17] and 8bpp row[32-33] and row[48-49].
+namespace Bitplane
+{
+
+// Byte i of the result is bit 7-i of plane
+inline uint64_t Spread(uint8_t plane)
+{
+    return ((plane * 0x8040201008040201ull) >> 7) & 0x0101010101010101ull;
+}
+
+template<int Planes>
+inline void DecodeScalar(const uint8_t* row, uint8_t out[8])
+{
+    uint64_t pixels = 0;
+    for (int pair = 0; pair < Planes / 2; pair++)
+    {
+        pixels |= Spread(row[pair*16]) << (pair*2);
+        pixels |= Spread(row[pair*16 + 1]) << (pair*2 + 1);
+    }
+    memcpy(out, &pixels, 8);
+}
+
+#if defined(__SSE2__)
+
+// Two planes at once, one per 8 byte lane, weighted by plane number
+inline __m128i DecodePair(const uint8_t* pair, int first)
+{
+    const __m128i bits = _mm_set1_epi64x(0x0102040810204080ll);
+    const __m128i weights = _mm_set_epi64x(0x0202020202020202ll << first, 0x0101010101010101ll << first);
+
+    uint16_t both;
+    memcpy(&both, pair, 2);
+
+    // b0 b1 -> b0 b0 b1 b1 -> 4x b0 4x b1 -> 8x b0 8x b1
+    __m128i planes = _mm_cvtsi32_si128(both);
+    planes = _mm_unpacklo_epi8(planes, planes);
+    planes = _mm_unpacklo_epi16(planes, planes);
+    planes = _mm_unpacklo_epi32(planes, planes);
+    __m128i set = _mm_cmpeq_epi8(_mm_and_si128(planes, bits), bits);
+    return _mm_and_si128(set, weights);
+}
+
+template<int Planes>
+inline void DecodeSSE2(const uint8_t* row, uint8_t out[8])
+{
+    __m128i v = DecodePair(row, 0);
+    for (int pair = 1; pair < Planes / 2; pair++)
+        v = _mm_or_si128(v, DecodePair(row + pair*16, pair*2));
+
+    v = _mm_or_si128(v, _mm_srli_si128(v, 8));
+    _mm_storel_epi64((__m128i*)out, v);
+}
+
+#endif
+
+#if defined(__AVX2__)
+
+// Four planes at once, one per 8 byte lane, weighted by plane number
+inline __m256i DecodeQuad(const uint8_t* row, int first)
+{
+    const __m256i bits = _mm256_set1_epi64x(0x0102040810204080ll);
+    const __m256i weights = _mm256_setr_epi64x(0x0101010101010101ll << first, 0x0202020202020202ll << first,
+                                               0x0404040404040404ll << first, 0x0808080808080808ll << first);
+
+    const __m256i spread = _mm256_setr_epi64x(0, 0x0101010101010101ll, 0x0202020202020202ll, 0x0303030303030303ll);
+
+    uint16_t lo, hi;
+    memcpy(&lo, row, 2);
+    memcpy(&hi, row + 16, 2);
+    __m256i planes = _mm256_broadcastsi128_si256(_mm_cvtsi32_si128(lo | (hi << 16)));
+    planes = _mm256_shuffle_epi8(planes, spread);
+    __m256i set = _mm256_cmpeq_epi8(_mm256_and_si256(planes, bits), bits);
+    return _mm256_and_si256(set, weights);
+}
+
+template<int Planes>
+inline void DecodeAVX2(const uint8_t* row, uint8_t out[8])
+{
+    if constexpr (Planes == 2)
+    {
+        DecodeScalar<2>(row, out);
+        return;
+    }
+
+    __m256i v = DecodeQuad(row, 0);
+    if constexpr (Planes == 8)
+        v = _mm256_or_si256(v, DecodeQuad(row + 32, 4));
+
+    // Fold the four lanes into one
+    v = _mm256_or_si256(v, _mm256_srli_si256(v, 8));
+    __m128i pixels = _mm_or_si128(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64((__m128i*)out, pixels);
+}
+
+#endif
+
+// SSE2 whenever it's there. The AVX2 path spends what it saves on folding
+// its four lanes back together and doesn't beat it in bitplanebench.
+template<int Planes>
+inline void Decode(const uint8_t* row, uint8_t out[8])
+{
+#if defined(__SSE2__)
+    DecodeSSE2<Planes>(row, out);
+#else
+    DecodeScalar<Planes>(row, out);
+#endif
+}
+
+}
@@ -0,0 +1,369 @@
+// Turns the layers drawn for a line into pixels: windows, main and sub
+// screen, colour math and brightness.
+//
+// Windows are 256-bit masks, one bit per pixel, built from the two ranges
+// and combined per layer with plain 64-bit logic. The visible pixel of each
+// screen is the max of the layer words (see PPU::Depths) with windowed
+// pixels cleared, eight or sixteen pixels at a time. Colour math works on
+// the 15-bit colours of the two screens a vector of pixels at a time too,
+// with each lane's 5-bit channels split out so they can't carry into each
+// other. Lines without colour math skip all of it and go straight from
+// CGRAM index to host colour.
+
+#include "ppu.h"
+#include "render.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+uint8_t tm, ts, tmw, tsw;
+uint8_t wsel[3];            // W12SEL, W34SEL, WOBJSEL: a nibble per layer, colour last
+uint8_t wh[4];              // Window 1 left and right, window 2 left and right
+uint8_t wbglog, wobjlog;
+uint8_t cgwsel, cgadsub;
+uint16_t fixed_color;       // COLDATA as a 15-bit colour
+
+namespace
+{
+
+// A 256 pixel window mask, bit x for pixel x
+struct Mask
+{
+    uint64_t bits[4];
+};
+
+// Pixels left to right inclusive, nothing if left is past right
+Mask Range(int left, int right)
+{
+    Mask m = {};
+    for (int i = 0; i < 4; i++)
+    {
+        int lo = std::max(left, i * 64), hi = std::min(right, i * 64 + 63);
+        if (lo <= hi)
+            m.bits[i] = (~0ull >> (63 - (hi - lo))) << (lo - i * 64);
+    }
+    return m;
+}
+
+// Area window 1 and 2 cover for a layer's W*SEL nibble and W*LOG bits, all
+// clear when the layer has neither enabled
+Mask LayerWindow(const Mask& w1, const Mask& w2, uint8_t sel, uint8_t logic)
+{
+    bool en1 = sel & 2, en2 = sel & 8;
+    uint64_t inv1 = (sel & 1) ? ~0ull : 0, inv2 = (sel & 4) ? ~0ull : 0;
+
+    Mask m = {};
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t a = w1.bits[i] ^ inv1;
+        uint64_t b = w2.bits[i] ^ inv2;
+        if (en1 && en2)
+        {
+            switch (logic & 3)
+            {
+            case 0: m.bits[i] = a | b; break;
+            case 1: m.bits[i] = a & b; break;
+            case 2: m.bits[i] = a ^ b; break;
+            case 3: m.bits[i] = ~(a ^ b); break;
+            }
+        }
+        else if (en1)
+            m.bits[i] = a;
+        else if (en2)
+            m.bits[i] = b;
+    }
+    return m;
+}
+
+// CGWSEL's never / outside / inside / always regions of the colour window
+Mask Region(const Mask& color, int mode)
+{
+    Mask m;
+    for (int i = 0; i < 4; i++)
+        m.bits[i] = mode == 0 ? 0 : mode == 1 ? ~color.bits[i] : mode == 2 ? color.bits[i] : ~0ull;
+    return m;
+}
+
+inline bool Test(const Mask& m, int x)
+{
+    return (m.bits[x >> 6] >> (x & 63)) & 1;
+}
+
+// Per pixel max over the layers in enabled, skipping the pixels in each
+// one's windowed area. windows[n] is null for a layer that isn't windowed.
+void Resolve(uint16_t layers[5][256], uint8_t enabled, const Mask* const windows[5], uint16_t out[256])
+{
+    const uint16_t* lines[5];
+    const uint8_t* masks[5];
+    int count = 0;
+    for (int l = 0; l < 5; l++)
+    {
+        if (enabled & (1 << l))
+        {
+            lines[count] = layers[l];
+            masks[count] = windows[l] ? (const uint8_t*)windows[l]->bits : nullptr;
+            count++;
+        }
+    }
+
+    // Words never reach 0x8000, so the signed max is fine
+#if defined(__AVX2__)
+    const __m256i select = _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, (short)32768);
+    for (int x = 0; x < 256; x += 16)
+    {
+        __m256i top = _mm256_setzero_si256();
+        for (int i = 0; i < count; i++)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)&lines[i][x]);
+            if (masks[i])
+            {
+                uint16_t bits;
+                memcpy(&bits, &masks[i][x >> 3], 2);
+                __m256i hidden = _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_set1_epi16(bits), select), select);
+                v = _mm256_andnot_si256(hidden, v);
+            }
+            top = _mm256_max_epi16(top, v);
+        }
+        _mm256_storeu_si256((__m256i*)&out[x], top);
+    }
+#elif defined(__SSE2__)
+    const __m128i select = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+    for (int x = 0; x < 256; x += 8)
+    {
+        __m128i top = _mm_setzero_si128();
+        for (int i = 0; i < count; i++)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)&lines[i][x]);
+            if (masks[i])
+            {
+                __m128i hidden = _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16(masks[i][x >> 3]), select), select);
+                v = _mm_andnot_si128(hidden, v);
+            }
+            top = _mm_max_epi16(top, v);
+        }
+        _mm_storeu_si128((__m128i*)&out[x], top);
+    }
+#else
+    for (int x = 0; x < 256; x++)
+    {
+        uint16_t top = 0;
+        for (int i = 0; i < count; i++)
+        {
+            uint16_t v = lines[i][x];
+            if (masks[i] && ((masks[i][x >> 3] >> (x & 7)) & 1))
+                v = 0;
+            top = v > top ? v : top;
+        }
+        out[x] = top;
+    }
+#endif
+}
+
+inline uint16_t Color15(int index)
+{
+    return (cgram[index * 2] | (cgram[index * 2 + 1] << 8)) & 0x7FFF;
+}
+
+// main +/- sub for lanes set in math, halved where half is set too.
+// Everything is 15-bit BGR, one colour per 16-bit lane.
+void Blend(uint16_t main[256], const uint16_t sub[256], const uint16_t math[256], const uint16_t half[256], bool subtract)
+{
+#if defined(__SSE2__)
+    const __m128i channel = _mm_set1_epi16(31);
+    for (int x = 0; x < 256; x += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)&main[x]);
+        __m128i b = _mm_loadu_si128((const __m128i*)&sub[x]);
+        __m128i h = _mm_loadu_si128((const __m128i*)&half[x]);
+        __m128i result = _mm_setzero_si128();
+
+        for (int shift = 0; shift < 15; shift += 5)
+        {
+            __m128i ca = _mm_and_si128(_mm_srli_epi16(a, shift), channel);
+            __m128i cb = _mm_and_si128(_mm_srli_epi16(b, shift), channel);
+            __m128i c = subtract ? _mm_subs_epu16(ca, cb) : _mm_add_epi16(ca, cb);
+            __m128i halved = _mm_srli_epi16(c, 1);
+            __m128i full = _mm_min_epi16(c, channel);
+            c = _mm_or_si128(_mm_and_si128(h, halved), _mm_andnot_si128(h, full));
+            result = _mm_or_si128(result, _mm_slli_epi16(c, shift));
+        }
+
+        __m128i m = _mm_loadu_si128((const __m128i*)&math[x]);
+        result = _mm_or_si128(_mm_and_si128(m, result), _mm_andnot_si128(m, a));
+        _mm_storeu_si128((__m128i*)&main[x], result);
+    }
+#else
+    for (int x = 0; x < 256; x++)
+    {
+        if (!math[x])
+            continue;
+        uint16_t result = 0;
+        for (int shift = 0; shift < 15; shift += 5)
+        {
+            int ca = (main[x] >> shift) & 31, cb = (sub[x] >> shift) & 31;
+            int c = subtract ? (ca > cb ? ca - cb : 0) : ca + cb;
+            c = half[x] ? c >> 1 : (c > 31 ? 31 : c);
+            result |= c << shift;
+        }
+        main[x] = result;
+    }
+#endif
+}
+
+}
+
+void PPU::ComposeLine(uint16_t layers[5][256], uint8_t drawn, uint32_t out[256])
+{
+    Mask w1 = Range(wh[0], wh[1]);
+    Mask w2 = Range(wh[2], wh[3]);
+
+    Mask windows[6];
+    for (int l = 0; l < 6; l++)
+    {
+        uint8_t sel = wsel[l >> 1] >> ((l & 1) * 4);
+        uint8_t logic = l < 4 ? wbglog >> (l * 2) : wobjlog >> ((l - 4) * 2);
+        windows[l] = LayerWindow(w1, w2, sel & 0xF, logic);
+    }
+
+    const Mask* main_windows[5];
+    const Mask* sub_windows[5];
+    for (int l = 0; l < 5; l++)
+    {
+        main_windows[l] = (tmw & (1 << l)) ? &windows[l] : nullptr;
+        sub_windows[l] = (tsw & (1 << l)) ? &windows[l] : nullptr;
+    }
+
+    uint16_t main[256];
+    Resolve(layers, drawn & tm, main_windows, main);
+
+    int black = cgwsel >> 6;
+    int prevent = (cgwsel >> 4) & 3;
+    if (!black && (prevent == 3 || !(cgadsub & 0x3F)))
+    {
+        // No colour math and nothing forced to black, CGRAM index to host colour
+        for (int x = 0; x < 256; x++)
+            out[x] = host_palette[main[x] & 0xFF];
+        return;
+    }
+
+    // Which layer each depth belongs to, so CGADSUB can be checked per pixel
+    uint8_t source[16] = {};
+    const Depths& depths = CurrentDepths();
+    for (int l = 0; l < 4; l++)
+    {
+        source[depths.bg[l][0]] = l;
+        source[depths.bg[l][1]] = l;
+    }
+    for (int p = 0; p < 4; p++)
+        source[depths.obj[p]] = 4;
+
+    Mask blacked = Region(windows[5], black);
+    Mask prevented = Region(windows[5], prevent);
+    bool use_sub = cgwsel & 2;
+    bool halve = cgadsub & 0x40;
+
+    uint16_t sub[256];
+    if (use_sub)
+        Resolve(layers, drawn & ts, sub_windows, sub);
+
+    uint16_t main15[256], sub15[256], math[256], half[256];
+    for (int x = 0; x < 256; x++)
+    {
+        uint16_t m = main[x];
+        bool black_here = Test(blacked, x);
+        main15[x] = black_here ? 0 : Color15(m & 0xFF);
+
+        // Sprites only take part with palettes 4-7
+        int src = m ? source[m >> 8] : 5;
+        bool enabled = (cgadsub >> src) & 1;
+        if (src == 4 && (m & 0xFF) < 192)
+            enabled = false;
+        math[x] = enabled && !Test(prevented, x) ? 0xFFFF : 0;
+
+        // A transparent sub screen pixel is the fixed colour, unhalved
+        bool sub_clear = !use_sub || !sub[x];
+        sub15[x] = sub_clear ? fixed_color : Color15(sub[x] & 0xFF);
+        half[x] = halve && !black_here && !(use_sub && sub_clear) ? 0xFFFF : 0;
+    }
+
+    Blend(main15, sub15, math, half, cgadsub & 0x80);
+
+    const uint8_t* lut = brightness_lut[inidisp & 0xF];
+    for (int x = 0; x < 256; x++)
+    {
+        uint16_t c = main15[x];
+        out[x] = (lut[c & 0x1F] << 24) | (lut[(c >> 5) & 0x1F] << 16) | (lut[(c >> 10) & 0x1F] << 8) | 0xff;
+    }
+}
+
+uint8_t PPU::ScreenLayers()
+{
+    return tm | ts;
+}
+
+void PPU::WriteTM(uint8_t data)
+{
+    tm = data;
+}
+
+void PPU::WriteTS(uint8_t data)
+{
+    ts = data;
+}
+
+void PPU::WriteTMW(uint8_t data)
+{
+    tmw = data;
+}
+
+void PPU::WriteTSW(uint8_t data)
+{
+    tsw = data;
+}
+
+void PPU::WriteWSEL(int index, uint8_t data)
+{
+    wsel[index] = data;
+}
+
+void PPU::WriteWH(int index, uint8_t data)
+{
+    wh[index] = data;
+}
+
+void PPU::WriteWBGLOG(uint8_t data)
+{
+    wbglog = data;
+}
+
+void PPU::WriteWOBJLOG(uint8_t data)
+{
+    wobjlog = data;
+}
+
+void PPU::WriteCGWSEL(uint8_t data)
+{
+    cgwsel = data;
+}
+
+void PPU::WriteCGADSUB(uint8_t data)
+{
+    cgadsub = data;
+}
+
+// Bits 5-7 pick which of red, green and blue take the intensity
+void PPU::WriteCOLDATA(uint8_t data)
+{
+    uint8_t intensity = data & 0x1F;
+    if (data & 0x20)
+        fixed_color = (fixed_color & ~0x001F) | intensity;
+    if (data & 0x40)
+        fixed_color = (fixed_color & ~0x03E0) | (intensity << 5);
+    if (data & 0x80)
+        fixed_color = (fixed_color & ~0x7C00) | (intensity << 10);
+}
@@ -0,0 +1,245 @@
+// Mode 7: one 1024x1024 layer of 8bpp tiles drawn through a 2x2 matrix.
+// The source coordinate is worked out once per line, after that it only
+// ever moves by (M7A, M7C) per pixel, so eight pixels' coordinates come
+// from adding a constant to a vector. Fetching the texels is scalar, there
+// is no gather before AVX2 and a byte gather doesn't exist at all.
+//
+// VRAM is interleaved: the low byte of word n is entry n of the 128x128
+// tile map, the high byte of word n is pixel n % 64 of tile n / 64.
+
+#include "ppu.h"
+#include "render.h"
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+uint8_t m7sel;
+int16_t m7a, m7b, m7c, m7d;
+int16_t m7x, m7y, m7hofs, m7vofs;    // 13-bit signed
+uint8_t m7_latch;
+uint8_t setini;
+
+namespace
+{
+
+inline int16_t Sign13(uint16_t v)
+{
+    return (int16_t)(v << 3) >> 3;
+}
+
+// The 10-bit signed distance from the centre the hardware works with
+inline int Clip(int v)
+{
+    return (v & 0x2000) ? (v | ~0x3FF) : (v & 0x3FF);
+}
+
+// Map index and in-tile pixel for 8 consecutive pixels starting at (px, py)
+// in 8.8 fixed point, stepping (dx, dy). inside is all ones for pixels within
+// the 1024x1024 layer.
+struct Coords
+{
+    int32_t map[8];
+    int32_t pixel[8];
+    int32_t inside[8];
+};
+
+#if defined(__AVX2__)
+
+inline void Step8(__m256i px, __m256i py, Coords& out)
+{
+    __m256i tx = _mm256_srai_epi32(px, 8);
+    __m256i ty = _mm256_srai_epi32(py, 8);
+    __m256i outside = _mm256_and_si256(_mm256_or_si256(tx, ty), _mm256_set1_epi32(~0x3FF));
+    __m256i inside = _mm256_cmpeq_epi32(outside, _mm256_setzero_si256());
+
+    __m256i col = _mm256_and_si256(_mm256_srai_epi32(tx, 3), _mm256_set1_epi32(127));
+    __m256i row = _mm256_and_si256(_mm256_srai_epi32(ty, 3), _mm256_set1_epi32(127));
+    __m256i map = _mm256_or_si256(_mm256_slli_epi32(row, 7), col);
+    __m256i pixel = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(ty, _mm256_set1_epi32(7)), 3),
+                                    _mm256_and_si256(tx, _mm256_set1_epi32(7)));
+
+    _mm256_storeu_si256((__m256i*)out.map, map);
+    _mm256_storeu_si256((__m256i*)out.pixel, pixel);
+    _mm256_storeu_si256((__m256i*)out.inside, inside);
+}
+
+#elif defined(__SSE2__)
+
+inline void Step4(__m128i px, __m128i py, Coords& out, int at)
+{
+    __m128i tx = _mm_srai_epi32(px, 8);
+    __m128i ty = _mm_srai_epi32(py, 8);
+    __m128i outside = _mm_and_si128(_mm_or_si128(tx, ty), _mm_set1_epi32(~0x3FF));
+    __m128i inside = _mm_cmpeq_epi32(outside, _mm_setzero_si128());
+
+    __m128i col = _mm_and_si128(_mm_srai_epi32(tx, 3), _mm_set1_epi32(127));
+    __m128i row = _mm_and_si128(_mm_srai_epi32(ty, 3), _mm_set1_epi32(127));
+    __m128i map = _mm_or_si128(_mm_slli_epi32(row, 7), col);
+    __m128i pixel = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(ty, _mm_set1_epi32(7)), 3),
+                                 _mm_and_si128(tx, _mm_set1_epi32(7)));
+
+    _mm_storeu_si128((__m128i*)&out.map[at], map);
+    _mm_storeu_si128((__m128i*)&out.pixel[at], pixel);
+    _mm_storeu_si128((__m128i*)&out.inside[at], inside);
+}
+
+#endif
+
+// Colour indices for the whole line, 0 where transparent. Outside is M7SEL's
+// screen over mode: wrap around (0 and 1), transparent (2) or tile 0 (3).
+template<int Outside>
+void Texels(int px, int py, int dx, int dy, uint8_t out[256])
+{
+    Coords c;
+
+#if defined(__AVX2__)
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i vx = _mm256_add_epi32(_mm256_set1_epi32(px), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(dx)));
+    __m256i vy = _mm256_add_epi32(_mm256_set1_epi32(py), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(dy)));
+    const __m256i step_x = _mm256_set1_epi32(dx * 8);
+    const __m256i step_y = _mm256_set1_epi32(dy * 8);
+#elif defined(__SSE2__)
+    __m128i vx = _mm_add_epi32(_mm_set1_epi32(px), _mm_setr_epi32(0, dx, dx * 2, dx * 3));
+    __m128i vy = _mm_add_epi32(_mm_set1_epi32(py), _mm_setr_epi32(0, dy, dy * 2, dy * 3));
+    const __m128i half_x = _mm_set1_epi32(dx * 4);
+    const __m128i half_y = _mm_set1_epi32(dy * 4);
+#endif
+
+    for (int x = 0; x < 256; x += 8)
+    {
+#if defined(__AVX2__)
+        Step8(vx, vy, c);
+        vx = _mm256_add_epi32(vx, step_x);
+        vy = _mm256_add_epi32(vy, step_y);
+#elif defined(__SSE2__)
+        Step4(vx, vy, c, 0);
+        vx = _mm_add_epi32(vx, half_x);
+        vy = _mm_add_epi32(vy, half_y);
+        Step4(vx, vy, c, 4);
+        vx = _mm_add_epi32(vx, half_x);
+        vy = _mm_add_epi32(vy, half_y);
+#else
+        for (int i = 0; i < 8; i++)
+        {
+            int tx = (px + dx * (x + i)) >> 8;
+            int ty = (py + dy * (x + i)) >> 8;
+            c.map[i] = ((ty >> 3) & 127) << 7 | ((tx >> 3) & 127);
+            c.pixel[i] = (ty & 7) << 3 | (tx & 7);
+            c.inside[i] = ((tx | ty) & ~0x3FF) ? 0 : -1;
+        }
+#endif
+
+        for (int i = 0; i < 8; i++)
+        {
+            uint8_t tile = vram[c.map[i] << 1];
+            if constexpr (Outside == 3)
+                tile &= c.inside[i];
+            uint8_t texel = vram[((tile << 6 | c.pixel[i]) << 1) + 1];
+            if constexpr (Outside == 2)
+                texel &= c.inside[i];
+            out[x + i] = texel;
+        }
+    }
+}
+
+}
+
+uint8_t PPU::RenderMode7(int y, uint8_t mask, uint16_t out[4][256])
+{
+    // BG2 is the same picture with bit 7 as its priority, under EXTBG
+    bool extbg = setini & 0x40;
+    mask &= extbg ? 3 : 1;
+    if (!mask)
+        return 0;
+
+    int sy = (m7sel & 2) ? 255 - y : y;
+    int sx = (m7sel & 1) ? 255 : 0;
+    int step = (m7sel & 1) ? -1 : 1;
+
+    int h = Clip(m7hofs - m7x);
+    int v = Clip(m7vofs - m7y);
+    int origin_x = ((m7a * h) & ~63) + ((m7b * v) & ~63) + ((m7b * sy) & ~63) + (m7x << 8);
+    int origin_y = ((m7c * h) & ~63) + ((m7d * v) & ~63) + ((m7d * sy) & ~63) + (m7y << 8);
+
+    int px = origin_x + m7a * sx;
+    int py = origin_y + m7c * sx;
+    int dx = m7a * step;
+    int dy = m7c * step;
+
+    uint8_t texels[256];
+    switch (m7sel >> 6)
+    {
+    case 2: Texels<2>(px, py, dx, dy, texels); break;
+    case 3: Texels<3>(px, py, dx, dy, texels); break;
+    default: Texels<0>(px, py, dx, dy, texels); break;
+    }
+
+    const Depths& depths = CurrentDepths();
+    if (mask & 1)
+    {
+        uint16_t depth = depths.bg[0][0] << 8;
+        for (int x = 0; x < 256; x++)
+            out[0][x] = texels[x] ? (depth | texels[x]) : 0;
+    }
+    if (mask & 2)
+    {
+        const uint16_t depth[2] = {(uint16_t)(depths.bg[1][0] << 8), (uint16_t)(depths.bg[1][1] << 8)};
+        for (int x = 0; x < 256; x++)
+        {
+            uint8_t c = texels[x] & 0x7F;
+            out[1][x] = c ? (depth[texels[x] >> 7] | c) : 0;
+        }
+    }
+    return mask;
+}
+
+// Matrix and centre registers are written twice, low byte first, through a
+// latch they share with mode 7's half of BG1HOFS/BG1VOFS
+void PPU::WriteM7(int index, uint8_t data)
+{
+    uint16_t value = data << 8 | m7_latch;
+    m7_latch = data;
+
+    switch (index)
+    {
+    case 0: m7a = value; break;
+    case 1: m7b = value; break;
+    case 2: m7c = value; break;
+    case 3: m7d = value; break;
+    case 4: m7x = Sign13(value); break;
+    case 5: m7y = Sign13(value); break;
+    }
+}
+
+void PPU::WriteM7HOFS(uint8_t data)
+{
+    m7hofs = Sign13(data << 8 | m7_latch);
+    m7_latch = data;
+}
+
+void PPU::WriteM7VOFS(uint8_t data)
+{
+    m7vofs = Sign13(data << 8 | m7_latch);
+    m7_latch = data;
+}
+
+void PPU::WriteM7SEL(uint8_t data)
+{
+    m7sel = data;
+}
+
+void PPU::WriteSETINI(uint8_t data)
+{
+    setini = data;
+}
+
+// MPYL/MPYM/MPYH, M7A times the last byte written to M7B, signed
+uint8_t PPU::ReadMPY(int index)
+{
+    int32_t product = m7a * (int8_t)(m7b >> 8);
+    return product >> (index * 8);
+}
@@ -1,44 +1,79 @@
 #include "ppu.h"
+#include "render.h"
+#include "tile_cache.h"
 #include "../mem/Bus.h"
+#include "../mem/dirty.h"
+#include "../mem/hdma.h"
+#include "../cpu/interrupt.h"
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <SDL2/SDL.h>
 
 uint8_t inidisp;
-uint8_t coldata;
 
 int scanline = 0;
 int cur_cycles = 0;
 int frames = 0;
 
-uint8_t vram[32*1024];
+uint8_t vram[64*1024];
 uint16_t vram_addr;
+uint16_t vram_prefetch;     // What RDVRAM reads, loaded as the address is set or steps
 uint16_t cg_addr = 0;
 uint8_t* cgram;
 
 uint8_t vmain;
 
-uint8_t bgmode, bg_tmap_start[4];
+uint8_t bgmode;
 
 SDL_Window* window;
 SDL_Renderer* renderer;
 SDL_Texture* screen_texture;
-uint32_t framebuffer[256*256];
+uint32_t framebuffer[256*224];
+
+// CGRAM as host colours with the INIDISP brightness already applied, so
+// drawing a pixel is one lookup. Kept up to date by every CGRAM write and
+// rebuilt when the brightness changes.
+uint32_t host_palette[256];
+uint8_t brightness_lut[16][32];     // 5-bit channel to 8-bit, per brightness level
+uint32_t line_buffer[256];
 
 #define printf(x, ...) 0
 
+void UpdatePaletteEntry(int index);
+void UpdatePalette();
+
 void PPU::Init()
 {
-    window = SDL_CreateWindow("SuperNinty", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1024, 896, 0);
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    screen_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC, 256, 256);
-
     cgram = new uint8_t[512];
     memset(cgram, 0, 512);
+    Dirty::SetMemory(Dirty::VRAM, vram);
+    Dirty::SetMemory(Dirty::CGRAM, cgram);
+
+    TileCache::Init(vram);
+
+    for (int level = 0; level < 16; level++)
+    {
+        for (int c = 0; c < 32; c++)
+            brightness_lut[level][c] = (c * 8 * (level + 1)) / 16;
+    }
+    UpdatePalette();
+}
+
+void PPU::OpenWindow()
+{
+    window = SDL_CreateWindow("SuperNinty", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1024, 896, 0);
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    screen_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC, 256, 224);
 }
 
-void RenderScreen()
+// Shows the finished frame at the start of vblank
+void PresentFrame()
 {
+    if (!renderer)
+        return;
+
     SDL_Event event;
     while (SDL_PollEvent(&event))
     {
@@ -50,79 +85,77 @@ void RenderScreen()
         }
     }
 
-    uint16_t base_addr = (bg_tmap_start[0] >> 2) << 11;
+    SDL_UpdateTexture(screen_texture, NULL, framebuffer, 256*sizeof(uint32_t));
+    SDL_RenderCopy(renderer, screen_texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+}
+
+void UpdatePaletteEntry(int index)
+{
+    uint16_t color = cgram[index*2] | (cgram[index*2+1] << 8);
+    const uint8_t* lut = brightness_lut[inidisp & 0xF];
+
+    host_palette[index] = (lut[color & 0x1F] << 24) | (lut[(color >> 5) & 0x1F] << 16) | (lut[(color >> 10) & 0x1F] << 8) | 0xff;
+}
 
-    printf("Drawing screen\n");
+void UpdatePalette()
+{
+    for (int i = 0; i < 256; i++)
+        UpdatePaletteEntry(i);
+}
 
-    for (int y = 0; y < 32; y++)
+// Layer depths for each mode, see PPU::Depths. Mode 1 has a second table
+// for when BGMODE bit 3 brings BG3's priority tiles to the very front.
+const PPU::Depths depth_tables[9] =
+{
+    {{{8, 11}, {7, 10}, {2, 5}, {1, 4}}, {3, 6, 9, 12}},    // 0
+    {{{6, 9}, {5, 8}, {1, 3}, {0, 0}}, {2, 4, 7, 10}},      // 1
+    {{{3, 7}, {1, 5}, {0, 0}, {0, 0}}, {2, 4, 6, 8}},       // 2
+    {{{3, 7}, {1, 5}, {0, 0}, {0, 0}}, {2, 4, 6, 8}},       // 3
+    {{{3, 7}, {1, 5}, {0, 0}, {0, 0}}, {2, 4, 6, 8}},       // 4
+    {{{3, 7}, {1, 5}, {0, 0}, {0, 0}}, {2, 4, 6, 8}},       // 5
+    {{{2, 5}, {0, 0}, {0, 0}, {0, 0}}, {1, 3, 4, 6}},       // 6
+    {{{3, 3}, {1, 5}, {0, 0}, {0, 0}}, {2, 4, 6, 7}},       // 7
+    {{{5, 8}, {4, 7}, {1, 10}, {0, 0}}, {2, 3, 6, 9}},      // 1 with BG3 priority
+};
+
+const PPU::Depths& PPU::CurrentDepths()
+{
+    if ((bgmode & 0xF) == 0x9)
+        return depth_tables[8];
+    return depth_tables[bgmode & 7];
+}
+
+// Draws visible scanline 1-224 with the registers, VRAM and CGRAM as they
+// are right now, so changes between lines show up where they were made
+void RenderLine(int scanline)
+{
+    int y = scanline - 1;
+
+    if (inidisp & 0x80)
     {
-        for (int x = 0; x < 32; x++)
-        {
-            uint16_t addr = base_addr + (y*32*2) + (x*2);
-            
-            uint16_t tile = *(uint16_t*)&vram[addr];
-            printf("Reading tile (%d,%d) (0x%04x) from 0x%04x\n", x, y, tile, addr);
-
-            uint8_t palette = (tile >> 10) & 0x7;
-            tile &= 0x3FF;
-            
-            for (int tile_y = 0; tile_y < 8; tile_y++)
-            {
-                // 8 groups of 4 bitplanes per tile
-                uint16_t addr = (tile * 32) + (tile_y*4);
-                uint8_t bplane_1 = vram[addr];
-                uint8_t bplane_2 = vram[addr+1];
-                uint8_t bplane_3 = vram[addr+16];
-                uint8_t bplane_4 = vram[addr+17];
-
-                printf("Read tile bitplanes (%x, %x, %x, %x) from 0x%04x (", bplane_1, bplane_2, bplane_3, bplane_4, addr);
-
-                for (int tile_x = 0; tile_x < 8; tile_x++)
-                {
-                    uint8_t pal_num;
-                    switch (tile_x)
-                    {
-                    case 0: pal_num = (((bplane_1 >> 7) & 1) << 0) | (((bplane_2 >> 7) & 1) << 1) | (((bplane_3 >> 7) & 1) << 2) | (((bplane_4 >> 7) & 1) << 3); break;
-                    case 1: pal_num = (((bplane_1 >> 6) & 1) << 0) | (((bplane_2 >> 6) & 1) << 1) | (((bplane_3 >> 6) & 1) << 2) | (((bplane_4 >> 6) & 1) << 3); break;
-                    case 2: pal_num = (((bplane_1 >> 5) & 1) << 0) | (((bplane_2 >> 5) & 1) << 1) | (((bplane_3 >> 5) & 1) << 2) | (((bplane_4 >> 5) & 1) << 3); break;
-                    case 3: pal_num = (((bplane_1 >> 4) & 1) << 0) | (((bplane_2 >> 4) & 1) << 1) | (((bplane_3 >> 4) & 1) << 2) | (((bplane_4 >> 4) & 1) << 3); break;
-                    case 4: pal_num = (((bplane_1 >> 3) & 1) << 0) | (((bplane_2 >> 3) & 1) << 1) | (((bplane_3 >> 3) & 1) << 2) | (((bplane_4 >> 3) & 1) << 3); break;
-                    case 5: pal_num = (((bplane_1 >> 2) & 1) << 0) | (((bplane_2 >> 2) & 1) << 1) | (((bplane_3 >> 2) & 1) << 2) | (((bplane_4 >> 2) & 1) << 3); break;
-                    case 6: pal_num = (((bplane_1 >> 1) & 1) << 0) | (((bplane_2 >> 1) & 1) << 1) | (((bplane_3 >> 1) & 1) << 2) | (((bplane_4 >> 1) & 1) << 3); break;
-                    case 7: pal_num = (((bplane_1 >> 0) & 1) << 0) | (((bplane_2 >> 0) & 1) << 1) | (((bplane_3 >> 0) & 1) << 2) | (((bplane_4 >> 0) & 1) << 3); break;
-                    default: exit(1);
-                    }
-
-                    printf("%02x", pal_num);
-                    if (tile_x == 7)
-                        printf(")\n");
-
-                    uint16_t color = *(uint16_t*)&cgram[(palette*32)+(pal_num*2)];
-                    color = __bswap_16(color);
-                    int r = color & 0x1F;
-                    int g = (color >> 5) & 0x1F;
-                    int b = (color >> 10) & 0x1F;
-
-                    r *= 8;
-                    g *= 8;
-                    b *= 8;
-
-                    framebuffer[(y*8*256)+(x*8) + tile_x + (tile_y*256)] = (r << 24) | (g << 16) | (b << 8) | 0xff;
-                }
-            }
-        }
+        // Forced blank
+        std::fill(line_buffer, line_buffer + 256, 0x000000ff);
     }
+    else
+    {
+        uint16_t layers[5][256];
+        uint8_t enabled = PPU::ScreenLayers();
+        uint8_t drawn = PPU::RenderBackgrounds(scanline, enabled & 0xF, layers);
+        if (PPU::RenderSprites(y, (enabled & 0x10) ? layers[4] : nullptr))
+            drawn |= 0x10;
 
-    SDL_UpdateTexture(screen_texture, NULL, framebuffer, 256*sizeof(uint32_t));
-    SDL_RenderCopy(renderer, screen_texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
+        PPU::ComposeLine(layers, drawn, line_buffer);
+    }
+
+    memcpy(&framebuffer[y*256], line_buffer, sizeof(line_buffer));
 }
 
 void PPU::Dump()
 {
     std::ofstream out("vram.bin");
 
-    out.write((char*)vram, 32*1024);
+    out.write((char*)vram, 64*1024);
     out.close();
 
     printf("Dumping cgram\n");
@@ -134,23 +167,38 @@ void PPU::Dump()
 
     printf("Done\n");
 
-    RenderScreen();
+    PresentFrame();
 }
 
 void PPU::Tick(int cycles)
 {
-    cur_cycles += cycles;
-
-    if (cur_cycles >= 341)
+    while (cycles > 0)
     {
+        // Up to the end of this scanline at most
+        int step = std::min(cycles, 341 - cur_cycles);
+        Interrupt::CheckTimer(scanline, cur_cycles, cur_cycles + step);
+        cur_cycles += step;
+        cycles -= step;
+
+        if (cur_cycles < 341)
+            break;
+
+        if (scanline >= 1 && scanline <= 224)
+            RenderLine(scanline);
+        if (scanline <= 224)
+            HDMA::RunLine(scanline);
+
         if (scanline == 0)
         {
             Bus::SetVblank(false);
+            PPU::ClearSpriteOverflow();
         }
         else if (scanline == 225)
         {
-            RenderScreen();
+            PresentFrame();
             Bus::SetVblank(true);
+            if (!(inidisp & 0x80))
+                PPU::ReloadOAMAddress();
         }
         cur_cycles -= 341;
         scanline++;
@@ -158,22 +206,30 @@ void PPU::Tick(int cycles)
         {
             frames++;
             scanline = 0;
+            HDMA::StartFrame();
         }
     }
 
     printf("V:%3d H:%3d F:%2d\n", scanline, cur_cycles, frames);
 }
 
-void PPU::WriteINIDISP(uint8_t data)
+int PPU::Frames()
 {
-    inidisp = data;
-    if (data == 0x0f)
-        RenderScreen();
+    return frames;
+}
+
+// Until the end of the scanline or the timer IRQ, whichever comes first
+int PPU::CyclesToNextEvent()
+{
+    return Interrupt::NextTimer(scanline, cur_cycles) - cur_cycles;
 }
 
-void PPU::WriteCOLDATA(uint8_t data)
+void PPU::WriteINIDISP(uint8_t data)
 {
-    coldata = data;
+    bool fade = (data ^ inidisp) & 0xF;
+    inidisp = data;
+    if (fade)
+        UpdatePalette();
 }
 
 void PPU::WriteBGMODE(uint8_t data)
@@ -182,17 +238,30 @@ void PPU::WriteBGMODE(uint8_t data)
     bgmode = data;
 }
 
-void PPU::WriteBGTMAPSTART(int index, uint8_t data)
+void LoadVRAMPrefetch()
 {
-    bg_tmap_start[index] = data;
+    memcpy(&vram_prefetch, &vram[(vram_addr << 1) & 0xFFFF], 2);
 }
 
 void PPU::WriteVMADD(uint16_t data)
 {
     vram_addr = data;
+    LoadVRAMPrefetch();
     printf("[PPU]: Setting VRAM addr to 0x%04x\n", vram_addr<<1);
 }
 
+void PPU::WriteVMADDL(uint8_t data)
+{
+    vram_addr = (vram_addr & 0xFF00) | data;
+    LoadVRAMPrefetch();
+}
+
+void PPU::WriteVMADDH(uint8_t data)
+{
+    vram_addr = (vram_addr & 0x00FF) | (data << 8);
+    LoadVRAMPrefetch();
+}
+
 void PPU::WriteVMAIN(uint8_t data)
 {
     vmain = data;
@@ -200,33 +269,111 @@ void PPU::WriteVMAIN(uint8_t data)
 
 void PPU::WriteVMDATA(uint16_t data)
 {
-    *(uint16_t*)&vram[(vram_addr << 1) & 0x7FFF] = data;
+    *(uint16_t*)&vram[(vram_addr << 1) & 0xFFFF] = data;
+    Dirty::Mark(Dirty::VRAM, (vram_addr << 1) & 0xFFFF);
+    TileCache::Invalidate((vram_addr << 1) & 0xFFFF);
     vram_addr++;
 }
 
 void PPU::WriteVMDATALow(uint8_t data)
 {
-    vram[(vram_addr << 1) & 0x7FFF] = data;
+    vram[(vram_addr << 1) & 0xFFFF] = data;
+    Dirty::Mark(Dirty::VRAM, (vram_addr << 1) & 0xFFFF);
+    TileCache::Invalidate((vram_addr << 1) & 0xFFFF);
     if (!((vmain >> 7) & 1))
         vram_addr++;
 }
 
 void PPU::WriteVMDATAHi(uint8_t data)
 {
-    vram[((vram_addr << 1) & 0x7FFF)+1] = data;
+    vram[((vram_addr << 1) & 0xFFFF)+1] = data;
+    Dirty::Mark(Dirty::VRAM, ((vram_addr << 1) & 0xFFFF)+1);
+    TileCache::Invalidate(((vram_addr << 1) & 0xFFFF)+1);
     if (((vmain >> 7) & 1))
         vram_addr++;
 }
 
+// Reads return the prefetched word, which reloads from the address before
+// it steps
+uint8_t PPU::ReadVMDATALow()
+{
+    uint8_t data = vram_prefetch;
+    if (!((vmain >> 7) & 1))
+    {
+        LoadVRAMPrefetch();
+        vram_addr++;
+    }
+    return data;
+}
+
+uint8_t PPU::ReadVMDATAHi()
+{
+    uint8_t data = vram_prefetch >> 8;
+    if (((vmain >> 7) & 1))
+    {
+        LoadVRAMPrefetch();
+        vram_addr++;
+    }
+    return data;
+}
+
+bool PPU::CanWriteVRAMSpan()
+{
+    return (vmain & 0x8F) == 0x80;
+}
+
+void PPU::WriteVRAMSpan(const uint8_t* src, uint32_t words, bool fixed)
+{
+    printf("[PPU]: Copying %d words to VRAM 0x%04x\n", words, vram_addr<<1);
+    while (words)
+    {
+        uint32_t offset = (vram_addr << 1) & 0xFFFF;
+        uint32_t n = std::min(words, (0x10000 - offset) >> 1);
+        if (fixed)
+            memset(&vram[offset], src[0], n*2);
+        else
+        {
+            memcpy(&vram[offset], src, n*2);
+            src += n*2;
+        }
+        Dirty::MarkRange(Dirty::VRAM, offset, n*2);
+        TileCache::InvalidateRange(offset, n*2);
+        vram_addr += n;
+        words -= n;
+    }
+}
+
+void PPU::WriteCGRAMSpan(const uint8_t* src, uint32_t bytes, bool fixed)
+{
+    while (bytes)
+    {
+        uint32_t n = std::min(bytes, 0x200u - cg_addr);
+        if (fixed)
+            memset(&cgram[cg_addr], src[0], n);
+        else
+        {
+            memcpy(&cgram[cg_addr], src, n);
+            src += n;
+        }
+        Dirty::MarkRange(Dirty::CGRAM, cg_addr, n);
+        for (uint32_t i = cg_addr >> 1; i <= (cg_addr + n - 1) >> 1; i++)
+            UpdatePaletteEntry(i);
+        cg_addr = (cg_addr + n) & 0x1FF;
+        bytes -= n;
+    }
+}
+
 void PPU::WriteCGDATA(uint8_t data)
 {
     printf("[PPU]: Setting CGRAM 0x%04x to 0x%02x\n", cg_addr, data);
-    cgram[cg_addr++] = data;
-    cg_addr &= 0x1FF;
+    Dirty::Mark(Dirty::CGRAM, cg_addr);
+    cgram[cg_addr] = data;
+    UpdatePaletteEntry(cg_addr >> 1);
+    cg_addr = (cg_addr + 1) & 0x1FF;
 }
 
 void PPU::WriteCGADD(uint8_t data)
 {
     printf("[PPU]: Setting CGRAM addr to 0x%04x\n", data);
-    cg_addr = data;
+    cg_addr = data << 1;
 }
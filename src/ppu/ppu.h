@@ -5,21 +5,67 @@
 namespace PPU
 {
 
+// Init sets up the PPU's state, OpenWindow the window frames are shown in.
+// Without a window frames are still drawn, just not shown.
 void Init();
+void OpenWindow();
 void Tick(int cycles);
+int CyclesToNextEvent();
+int Frames();   // Finished since power on
 void Dump();
 
 void WriteINIDISP(uint8_t data);
-void WriteCOLDATA(uint8_t data);
+void WriteOBSEL(uint8_t data);
+void WriteOAMADDL(uint8_t data);
+void WriteOAMADDH(uint8_t data);
+void WriteOAMDATA(uint8_t data);
+uint8_t ReadOAMDATA();
+uint8_t ReadSTAT77();
 void WriteBGMODE(uint8_t data);
 void WriteBGTMAPSTART(int index, uint8_t data);
+void WriteBGNBA(int index, uint8_t data);
+void WriteBGHOFS(int layer, uint8_t data);
+void WriteBGVOFS(int layer, uint8_t data);
+void WriteSETINI(uint8_t data);
+
+// Screens, windows and colour math. WriteWSEL is W12SEL, W34SEL and WOBJSEL
+// as 0-2, WriteWH is WH0-WH3.
+void WriteTM(uint8_t data);
+void WriteTS(uint8_t data);
+void WriteTMW(uint8_t data);
+void WriteTSW(uint8_t data);
+void WriteWSEL(int index, uint8_t data);
+void WriteWH(int index, uint8_t data);
+void WriteWBGLOG(uint8_t data);
+void WriteWOBJLOG(uint8_t data);
+void WriteCGWSEL(uint8_t data);
+void WriteCGADSUB(uint8_t data);
+void WriteCOLDATA(uint8_t data);
+
+// Mode 7. WriteM7 is M7A-M7D, M7X and M7Y as 0-5.
+void WriteM7SEL(uint8_t data);
+void WriteM7(int index, uint8_t data);
+void WriteM7HOFS(uint8_t data);
+void WriteM7VOFS(uint8_t data);
+uint8_t ReadMPY(int index);
 
 void WriteVMADD(uint16_t data);
+void WriteVMADDL(uint8_t data);
+void WriteVMADDH(uint8_t data);
 void WriteVMAIN(uint8_t data);
 
 void WriteVMDATA(uint16_t data);
 void WriteVMDATALow(uint8_t data);
 void WriteVMDATAHi(uint8_t data);
+uint8_t ReadVMDATALow();
+uint8_t ReadVMDATAHi();
+
+// DMA fast paths. VRAM spans are whole words and need VMAIN to step one
+// word after the high byte, fixed repeats src[0] for every byte.
+bool CanWriteVRAMSpan();
+void WriteVRAMSpan(const uint8_t* src, uint32_t words, bool fixed);
+void WriteCGRAMSpan(const uint8_t* src, uint32_t bytes, bool fixed);
+void WriteOAMSpan(const uint8_t* src, uint32_t bytes, bool fixed);
 
 void WriteCGDATA(uint8_t data);
 void WriteCGADD(uint8_t data);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+// State shared by the parts of the PPU that draw a scanline. Not for use
+// outside src/ppu.
+
+extern uint8_t vram[64*1024];
+extern uint8_t* cgram;
+extern uint32_t host_palette[256];
+extern uint8_t brightness_lut[16][32];
+extern uint8_t inidisp;
+extern uint8_t bgmode;
+
+namespace PPU
+{
+
+// Layers draw a line as one word per pixel, depth << 8 | CGRAM index, and 0
+// where transparent. Depths order every layer and priority of the current
+// mode front to back, higher in front, so the visible pixel is the max.
+struct Depths
+{
+    uint8_t bg[4][2];   // Per layer, tile priority bit clear and set
+    uint8_t obj[4];     // Per sprite priority
+};
+
+const Depths& CurrentDepths();
+
+// Draws the background layers in mask (bit n for BGn+1) for scanline y,
+// layer n into out[n]. Returns the ones the current mode has.
+uint8_t RenderBackgrounds(int y, uint8_t mask, uint16_t out[4][256]);
+uint8_t RenderMode7(int y, uint8_t mask, uint16_t out[4][256]);
+
+// Draws the sprites on screen row y (scanline - 1) into out, false if there
+// are none. Always call it for displayed lines, out can be null when OBJ is
+// off, it also records range and time over.
+bool RenderSprites(int y, uint16_t* out);
+void ClearSpriteOverflow();
+void ReloadOAMAddress();
+
+// BG1-4 and OBJ bits of the layers either screen shows
+uint8_t ScreenLayers();
+
+// Windows, main and sub screen, colour math and brightness for the layers
+// in drawn, into host colours
+void ComposeLine(uint16_t layers[5][256], uint8_t drawn, uint32_t out[256]);
+
+}
@@ -0,0 +1,292 @@
+// Sprites. OAM is 128 four byte entries plus a 32 byte table with two more
+// bits for each (X bit 8 and the size select).
+//
+// The hardware looks at all 128 entries on every line. Here that work is
+// done once after OAM, OBSEL or the priority rotation changes: every line
+// gets the list of (at most) 32 sprites on it and the 34 eight pixel tile
+// slivers it will actually draw, in drawing order, so drawing a line is
+// just those slivers. The tables are rebuilt lazily at the next line drawn
+// after a change, so a whole OAM upload during vblank costs one rebuild.
+
+#include "ppu.h"
+#include "render.h"
+#include "tile_cache.h"
+#include <algorithm>
+#include <cstring>
+
+uint8_t oam[544];
+uint16_t oam_addr;          // Byte address, 10 bits
+uint16_t oam_reload;        // OAMADDL/H as written
+uint8_t oam_latch;
+uint8_t obsel;
+uint8_t stat77;
+
+namespace
+{
+
+static constexpr int Lines = 224;
+static constexpr int MaxSprites = 32;
+static constexpr int MaxSlivers = 34;
+
+struct Sliver
+{
+    int16_t x;
+    uint16_t addr;      // VRAM byte address of the 8x8 tile
+    uint8_t row;        // Pixel row in it, flips applied
+    uint8_t attr;       // OAM byte 3: flips, priority and palette
+};
+
+struct LineSprites
+{
+    uint8_t sprites;
+    uint8_t slivers;
+    uint8_t index[MaxSprites];
+    Sliver sliver[MaxSlivers];
+    uint8_t overflow;   // STAT77 bits this line sets
+};
+
+LineSprites lines[Lines];
+bool dirty = true;
+
+// Small and large sprite sizes in pixels for each OBSEL size select
+const uint8_t sizes[8][2][2] =
+{
+    {{8, 8}, {16, 16}},
+    {{8, 8}, {32, 32}},
+    {{8, 8}, {64, 64}},
+    {{16, 16}, {32, 32}},
+    {{16, 16}, {64, 64}},
+    {{32, 32}, {64, 64}},
+    {{16, 32}, {32, 64}},
+    {{16, 32}, {32, 32}},
+};
+
+struct Sprite
+{
+    int x;
+    uint8_t y, tile, attr;
+    uint8_t w, h;
+};
+
+Sprite Decode(int n)
+{
+    const uint8_t* e = &oam[n * 4];
+    uint8_t high = oam[0x200 + (n >> 2)] >> ((n & 3) * 2);
+
+    Sprite s;
+    s.x = e[0] | ((high & 1) << 8);
+    if (s.x & 0x100)
+        s.x -= 512;
+    s.y = e[1];
+    s.tile = e[2];
+    s.attr = e[3];
+    const uint8_t* size = sizes[obsel >> 5][(high >> 1) & 1];
+    s.w = size[0];
+    s.h = size[1];
+    return s;
+}
+
+// VRAM address of the 8x8 tile at column cx, row cy of the sprite. Tile
+// numbers wrap within their 16x16 block, the second 256 live after a gap.
+uint16_t TileAddress(const Sprite& s, int cx, int cy)
+{
+    uint32_t base = (obsel & 7) << 14;
+    if (s.attr & 1)
+        base += (((obsel >> 3) & 3) + 1) << 13;
+    uint8_t tile = (((s.tile >> 4) + cy) & 0xF) << 4 | ((s.tile + cx) & 0xF);
+    return (base + tile * 32) & 0xFFFF;
+}
+
+void Rebuild()
+{
+    for (LineSprites& l : lines)
+    {
+        l.sprites = 0;
+        l.slivers = 0;
+        l.overflow = 0;
+    }
+
+    // Range: the first 32 sprites on each line, starting from the rotation
+    int first = (oam_reload & 0x8000) ? (oam_reload >> 1) & 0x7F : 0;
+    for (int i = 0; i < 128; i++)
+    {
+        int n = (first + i) & 127;
+        Sprite s = Decode(n);
+        if (s.x <= -s.w || s.x >= 256)
+            continue;
+
+        for (int r = 0; r < s.h; r++)
+        {
+            int line = (s.y + r) & 0xFF;
+            if (line >= Lines)
+                continue;
+            LineSprites& l = lines[line];
+            if (l.sprites < MaxSprites)
+                l.index[l.sprites++] = n;
+            else
+                l.overflow |= 0x40;
+        }
+    }
+
+    // Time: their on-screen tiles, last sprite first, so the earliest ones
+    // lose out past 34 but are drawn last and end up in front
+    for (int line = 0; line < Lines; line++)
+    {
+        LineSprites& l = lines[line];
+        for (int i = l.sprites - 1; i >= 0 && !(l.overflow & 0x80); i--)
+        {
+            Sprite s = Decode(l.index[i]);
+            int row = (uint8_t)(line - s.y);
+            if (s.attr & 0x80)
+                row = s.h - 1 - row;
+
+            int columns = s.w / 8;
+            for (int c = 0; c < columns; c++)
+            {
+                int x = s.x + c * 8;
+                if (x <= -8 || x >= 256)
+                    continue;
+                if (l.slivers == MaxSlivers)
+                {
+                    l.overflow |= 0x80;
+                    break;
+                }
+                int cx = (s.attr & 0x40) ? columns - 1 - c : c;
+                l.sliver[l.slivers++] = {(int16_t)x, TileAddress(s, cx, row >> 3), (uint8_t)(row & 7), s.attr};
+            }
+        }
+    }
+
+    dirty = false;
+}
+
+}
+
+bool PPU::RenderSprites(int y, uint16_t* out)
+{
+    if (dirty)
+        Rebuild();
+
+    const LineSprites& l = lines[y];
+    stat77 |= l.overflow;
+    if (!out || !l.slivers)
+        return false;
+
+    const Depths& depths = CurrentDepths();
+    uint16_t padded[8 + 256 + 8] = {};
+
+    for (int i = 0; i < l.slivers; i++)
+    {
+        const Sliver& s = l.sliver[i];
+        const uint8_t* pixels = TileCache::Get(TileCache::Bpp4, s.addr) + s.row * 8;
+        uint16_t color = depths.obj[(s.attr >> 4) & 3] << 8 | (128 + ((s.attr >> 1) & 7) * 16);
+        uint16_t* dst = &padded[8 + s.x];
+
+        if (s.attr & 0x40)
+        {
+            for (int p = 0; p < 8; p++)
+            {
+                if (pixels[7 - p])
+                    dst[p] = color | pixels[7 - p];
+            }
+        }
+        else
+        {
+            for (int p = 0; p < 8; p++)
+            {
+                if (pixels[p])
+                    dst[p] = color | pixels[p];
+            }
+        }
+    }
+
+    memcpy(out, &padded[8], 256 * sizeof(uint16_t));
+    return true;
+}
+
+// Range and time over are cleared as vblank ends
+void PPU::ClearSpriteOverflow()
+{
+    stat77 &= 0x3F;
+}
+
+// And the OAM address goes back to the last OAMADD write as it starts
+void PPU::ReloadOAMAddress()
+{
+    oam_addr = (oam_reload << 1) & 0x3FF;
+}
+
+void PPU::WriteOBSEL(uint8_t data)
+{
+    obsel = data;
+    dirty = true;
+}
+
+void PPU::WriteOAMADDL(uint8_t data)
+{
+    oam_reload = (oam_reload & 0xFF00) | data;
+    oam_addr = (oam_reload << 1) & 0x3FF;
+    dirty = true;
+}
+
+void PPU::WriteOAMADDH(uint8_t data)
+{
+    oam_reload = (oam_reload & 0x00FF) | (data << 8);
+    oam_addr = (oam_reload << 1) & 0x3FF;
+    dirty = true;
+}
+
+// The low table is written a word at a time: even bytes wait in a latch
+// until the odd one arrives. The high table takes single bytes.
+void PPU::WriteOAMDATA(uint8_t data)
+{
+    if (!(oam_addr & 1))
+        oam_latch = data;
+
+    if (oam_addr >= 0x200)
+        oam[0x200 | (oam_addr & 0x1F)] = data;
+    else if (oam_addr & 1)
+    {
+        oam[oam_addr - 1] = oam_latch;
+        oam[oam_addr] = data;
+    }
+
+    oam_addr = (oam_addr + 1) & 0x3FF;
+    dirty = true;
+}
+
+uint8_t PPU::ReadOAMDATA()
+{
+    uint8_t data = oam[oam_addr >= 0x200 ? 0x200 | (oam_addr & 0x1F) : oam_addr];
+    oam_addr = (oam_addr + 1) & 0x3FF;
+    return data;
+}
+
+void PPU::WriteOAMSpan(const uint8_t* src, uint32_t bytes, bool fixed)
+{
+    while (bytes)
+    {
+        // Whole words of the low table go straight in
+        if (!fixed && !(oam_addr & 1) && oam_addr < 0x200 && bytes >= 2)
+        {
+            uint32_t n = std::min(bytes & ~1u, 0x200u - oam_addr);
+            memcpy(&oam[oam_addr], src, n);
+            oam_latch = src[n - 2];
+            oam_addr += n;
+            src += n;
+            bytes -= n;
+            dirty = true;
+            continue;
+        }
+
+        WriteOAMDATA(src[0]);
+        if (!fixed)
+            src++;
+        bytes--;
+    }
+}
+
+uint8_t PPU::ReadSTAT77()
+{
+    return stat77 | 0x01;
+}
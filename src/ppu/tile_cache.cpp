@@ -0,0 +1,56 @@
+#include "tile_cache.h"
+#include "bitplane.h"
+
+#include <cstring>
+
+namespace TileCache
+{
+
+static uint8_t tiles_2bpp[(MaxVram >> 4) * 64], valid_2bpp[MaxVram >> 4];
+static uint8_t tiles_4bpp[(MaxVram >> 5) * 64], valid_4bpp[MaxVram >> 5];
+static uint8_t tiles_8bpp[(MaxVram >> 6) * 64], valid_8bpp[MaxVram >> 6];
+
+// Indexed by Format
+uint8_t* tiles[FormatCount] = {tiles_2bpp, tiles_4bpp, tiles_8bpp};
+uint8_t* valid[FormatCount] = {valid_2bpp, valid_4bpp, valid_8bpp};
+
+static const uint8_t* vram;
+
+void Init(const uint8_t* data)
+{
+    vram = data;
+    InvalidateRange(0, MaxVram);
+}
+
+void Decode(Format format, uint32_t index)
+{
+    const uint8_t* tile = vram + (index << (4 + format));
+    uint8_t* out = &tiles[format][index * 64];
+
+    for (int y = 0; y < 8; y++)
+    {
+        switch (format)
+        {
+        case Bpp2: Bitplane::Decode<2>(tile + y*2, out + y*8); break;
+        case Bpp4: Bitplane::Decode<4>(tile + y*2, out + y*8); break;
+        default:   Bitplane::Decode<8>(tile + y*2, out + y*8); break;
+        }
+    }
+
+    valid[format][index] = 1;
+}
+
+void InvalidateRange(uint32_t offset, uint32_t length)
+{
+    if (!length)
+        return;
+
+    for (int format = 0; format < FormatCount; format++)
+    {
+        uint32_t first = offset >> (4 + format);
+        uint32_t last = (offset + length - 1) >> (4 + format);
+        memset(&valid[format][first], 0, last - first + 1);
+    }
+}
+
+}
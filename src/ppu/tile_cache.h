@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+// Tiles decoded from VRAM into one palette index per pixel, 8 rows of 8,
+// for each bit depth. A tile is decoded the first time it's drawn and then
+// reused until a write to VRAM touches its bytes.
+namespace TileCache
+{
+
+enum Format
+{
+    Bpp2,   // 16 bytes per tile
+    Bpp4,   // 32
+    Bpp8,   // 64
+    FormatCount,
+};
+
+// Room for the whole 64 KB of VRAM in every format
+static constexpr uint32_t MaxVram = 64*1024;
+
+extern uint8_t* tiles[FormatCount];
+extern uint8_t* valid[FormatCount];
+
+void Init(const uint8_t* vram);
+void Decode(Format format, uint32_t index);
+
+// The tile at VRAM byte address addr
+inline const uint8_t* Get(Format format, uint32_t addr)
+{
+    uint32_t index = addr >> (4 + format);
+    if (!valid[format][index])
+        Decode(format, index);
+    return &tiles[format][index * 64];
+}
+
+// VRAM byte offset was written
+inline void Invalidate(uint32_t offset)
+{
+    valid[Bpp2][offset >> 4] = 0;
+    valid[Bpp4][offset >> 5] = 0;
+    valid[Bpp8][offset >> 6] = 0;
+}
+
+void InvalidateRange(uint32_t offset, uint32_t length);
+
+}
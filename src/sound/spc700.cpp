@@ -4,6 +4,7 @@
 #include <cassert>
 #include <stdio.h>
 #include "dsp.h"
+#include "../mem/dirty.h"
 
 namespace SPC700
 {
@@ -15,6 +16,7 @@ uint8_t psw;
 
 uint8_t port0, port1, port2, port3;
 uint8_t in_port0, in_port1, in_port2, in_port3; // Values sent from the SNES
+uint32_t port_changes = 0;  // Times a port the SNES reads got a new value
 
 uint8_t ram[64*1024];
 
@@ -43,6 +45,7 @@ void Reset()
     sp = 0xFF;
     psw = 0;
     pc = 0xFFC0;
+    Dirty::SetMemory(Dirty::ARAM, ram);
 }
 
 void Dump()
@@ -93,11 +96,13 @@ void Write8(uint16_t addr, uint8_t data)
     if (addr < 0xF0)
     {
         ram[addr] = data;
+        Dirty::Mark(Dirty::ARAM, addr);
         return;
     }
     if (addr >= 0x0100 && addr < 0xFFC0)
     {
         ram[addr] = data;
+        Dirty::Mark(Dirty::ARAM, addr);
         return;
     }
 
@@ -108,23 +113,33 @@ void Write8(uint16_t addr, uint8_t data)
         timers[1].started = (data & 2);
         timers[2].started = (data & 4);
         if ((data >> 4) & 1)
+        {
+            port_changes += port0 || port1;
             port0 = port1 = in_port0 = in_port1 = 0;
+        }
         if ((data >> 5) & 1)
+        {
+            port_changes += port2 || port3;
             port2 = port3 = in_port2 = in_port3 = 0;
+        }
         return;
     case 0xF3:
         DSP::Write(selected_dsp_reg, data);
         return;
     case 0xF4:
+        port_changes += port0 != data;
         port0 = data;
         return;
     case 0xF5:
+        port_changes += port1 != data;
         port1 = data;
         return;
     case 0xF6:
+        port_changes += port2 != data;
         port2 = data;
         return;
     case 0xF7:
+        port_changes += port3 != data;
         port3 = data;
         return;
     case 0xFA ... 0xFC:
@@ -865,6 +880,11 @@ void Tick(int cycles)
     }
 }
 
+uint32_t PortChanges()
+{
+    return port_changes;
+}
+
 uint8_t ReadPort(uint8_t port)
 {
     switch (port)
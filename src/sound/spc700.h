@@ -13,6 +13,7 @@ void Reset();
 void Dump();
 void Tick(int cycles);
 
+uint32_t PortChanges();
 uint8_t ReadPort(uint8_t port);
 void WritePort(uint8_t port, uint8_t data);
 
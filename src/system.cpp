@@ -0,0 +1,87 @@
+#include "system.h"
+#include "cpu/cpu.h"
+#include "mem/Bus.h"
+#include "mem/hdma.h"
+#include "ppu/ppu.h"
+#include "sound/spc700.h"
+
+#include <algorithm>
+
+int stall_clocks = 0;
+
+// The CPU is spinning on something only the PPU, APU or an interrupt can
+// change. Runs the APU ahead to the next scanline or timer IRQ, or until it
+// writes a new value to a port, and returns how many CPU cycles passed. The
+// APU is always ticked for exactly that many CPU cycles, as if the skipped
+// time had gone through the normal loop.
+int SkipIdle(int cycles)
+{
+    int next = (PPU::CyclesToNextEvent() + 1) / 2;
+    int spc_cycles = (int)(cycles / 1.3358209);
+    SPC700::Tick(spc_cycles);
+    if (cycles >= next)
+        return cycles;
+
+    uint32_t ports = SPC700::PortChanges();
+    while (cycles < next && SPC700::PortChanges() == ports)
+    {
+        cycles = std::min(next, cycles + 21); // ~16 APU cycles
+        int target = (int)(cycles / 1.3358209);
+        SPC700::Tick(target - spc_cycles);
+        spc_cycles = target;
+    }
+
+    return cycles;
+}
+
+// DMA halts the CPU while the PPU and APU carry on
+void RunStall()
+{
+    stall_clocks += HDMA::TakeStall();
+    while (stall_clocks >= 8)
+    {
+        int cycles = stall_clocks / 8;
+        stall_clocks -= cycles * 8;
+        PPU::Tick((cycles*8)/4);
+        SPC700::Tick((int)(cycles / 1.3358209));
+        stall_clocks += HDMA::TakeStall();
+    }
+}
+
+CPU* System::PowerOn()
+{
+    Bus::Init();
+    PPU::Init();
+    SPC700::LoadIPL("spc700.rom");
+    SPC700::Reset();
+
+    CPU* cpu = new CPU();
+    PPU::Tick(34);
+    return cpu;
+}
+
+int System::Step(CPU* cpu)
+{
+    int cycles = 0;
+    int instructions = 0;
+    while (instructions < 4)
+    {
+        cycles += cpu->Clock();
+        instructions += cpu->Ran();
+        if (cpu->Idle() || HDMA::Stalling())
+            break;
+    }
+
+    if (cpu->Idle())
+    {
+        cycles = SkipIdle(cycles);
+        PPU::Tick((cycles*8)/4);
+        RunStall();
+        return instructions;
+    }
+
+    PPU::Tick((cycles*8)/4);
+    SPC700::Tick((int)(cycles / 1.3358209));
+    RunStall();
+    return instructions;
+}
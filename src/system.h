@@ -0,0 +1,19 @@
+#pragma once
+
+class CPU;
+
+// Runs the CPU, PPU and APU in step, shared by the emulator and cpubench
+namespace System
+{
+
+// Brings up the bus, the PPU state and the APU and returns the CPU at its
+// reset vector. Showing frames is up to the caller, see PPU::OpenWindow.
+CPU* PowerOn();
+
+// Runs four instructions, or skips ahead while the CPU is idle, then the
+// PPU, APU and any DMA stall for the same time. A compiled block counts as
+// all of its instructions and can take the step past four. Returns the
+// number of instructions run.
+int Step(CPU* cpu);
+
+}
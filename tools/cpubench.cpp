@@ -0,0 +1,77 @@
+// Measures how much host work the emulator does per emulated instruction.
+// Runs doom.smc and spc700.rom from the current directory the way the
+// emulator does, PPU and APU included, just without a window.
+//
+// Usage: cpubench [instructions]
+//
+// Host instructions are counted with perf events when the kernel allows it,
+// otherwise only the time per instruction is reported.
+
+#include "cpu/cpu.h"
+#include "system.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+CPU* cpu;
+
+// Counts user space instructions retired by this thread, -1 on failure
+int OpenCounter()
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int main(int argc, char** argv)
+{
+    long count = argc > 1 ? atol(argv[1]) : 10000000;
+
+    cpu = System::PowerOn();
+
+    int counter = OpenCounter();
+    if (counter < 0)
+        printf("perf events unavailable, timing only\n");
+    else
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    long run = 0;
+    while (run < count)
+        run += System::Step(cpu);
+
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    printf("%ld instructions\n", run);
+    printf("%.2f ns per instruction\n", ns / run);
+
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+
+        uint64_t host = 0;
+        if (read(counter, &host, sizeof(host)) == sizeof(host))
+            printf("%.1f host instructions per instruction\n", (double)host / run);
+        close(counter);
+    }
+
+    return 0;
+}
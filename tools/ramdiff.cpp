@@ -0,0 +1,95 @@
+// Streams what changed in WRAM, VRAM, CGRAM and SPC RAM from one frame to
+// the next. Runs doom.smc and spc700.rom from the current directory the way
+// cpubench does, without a window, and after every frame writes out the
+// pages that were written during it.
+//
+// Usage: ramdiff [frames] [ramdiff.bin]
+//
+// The stream is one record per changed page: a little-endian uint32 frame,
+// uint8 region (0 WRAM, 1 VRAM, 2 CGRAM, 3 ARAM), uint16 page and uint16
+// size, followed by size bytes of the page. Frame 0 has every page, the
+// state at power on.
+
+#include "cpu/cpu.h"
+#include "mem/dirty.h"
+#include "ppu/ppu.h"
+#include "system.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+CPU* cpu;
+
+static const char* names[Dirty::RegionCount] = {"WRAM", "VRAM", "CGRAM", "ARAM"};
+
+static void Put(FILE* out, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        fputc(value >> (i*8), out);
+}
+
+// Writes the pages of region marked in bits, returns how many
+static int WritePages(FILE* out, uint32_t frame, Dirty::Region region, const std::vector<uint64_t>& bits)
+{
+    const uint8_t* data = Dirty::Memory(region);
+    uint32_t size = Dirty::PageSize(region);
+    int count = 0;
+
+    for (uint32_t page = 0; page < Dirty::PageCount(region); page++)
+    {
+        if (!(bits[page >> 6] & (1ull << (page & 63))))
+            continue;
+
+        Put(out, frame, 4);
+        Put(out, region, 1);
+        Put(out, page, 2);
+        Put(out, size, 2);
+        fwrite(data + page*size, 1, size, out);
+        count++;
+    }
+
+    return count;
+}
+
+int main(int argc, char** argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 60;
+    const char* path = argc > 2 ? argv[2] : "ramdiff.bin";
+
+    FILE* out = fopen(path, "wb");
+    if (!out)
+    {
+        printf("Couldn't open %s\n", path);
+        return 1;
+    }
+
+    cpu = System::PowerOn();
+
+    int consumers[Dirty::RegionCount];
+    for (int r = 0; r < Dirty::RegionCount; r++)
+        consumers[r] = Dirty::AddConsumer((Dirty::Region)r);
+
+    std::vector<uint64_t> bits;
+    for (int frame = 0; frame <= frames; frame++)
+    {
+        // Frame 0 is everything up to now, the first Snapshot has it all
+        if (frame)
+        {
+            int start = PPU::Frames();
+            while (PPU::Frames() == start)
+                System::Step(cpu);
+        }
+
+        printf("[RAMDIFF]: Frame %d:", frame);
+        for (int r = 0; r < Dirty::RegionCount; r++)
+        {
+            Dirty::Snapshot(consumers[r], bits);
+            printf(" %s %d", names[r], WritePages(out, frame, (Dirty::Region)r, bits));
+        }
+        printf("\n");
+    }
+
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,340 @@
+// Turns a binary trace written by a SNES_TRACE build back into the text log
+// the CPU used to print for every instruction.
+//
+// Usage: tracedump [trace.bin] [-c]
+//   -c  append the running cycle count to every line
+
+#include "cpu/trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+enum Mode
+{
+    Unknown,
+    Imp,        // xba
+    ImmM,       // lda #$nn / #$nnnn, width from M
+    ImmX,       // ldx #$nn / #$nnnn, width from X
+    ImmP,       // rep #$n
+    Imm16,      // pea #$nnnn
+    Dir,        // lda $nn
+    DirS,       // sta $nn (one space of padding instead of three)
+    DirX,       // stz $nn,x
+    DirInd,     // lda ($nn)
+    DirLng,     // lda [$nn]
+    DirLng8,    // sta [$nn], pointer wraps within the direct page
+    DirLngY,    // lda [$nn],y
+    Abs,        // lda $nnnn
+    AbsX,       // lda $nnnn,x
+    AbsY,       // sta $nnnn,y
+    AbsInd,     // jmp ($nnnn)
+    AbsXInd,    // jsr ($nnnn,x)
+    Lng,        // jsl $nnnnnn
+    LngX,       // lda $nnnnnn,x
+    Rel,        // bne $nnnnnn
+};
+
+enum Flags
+{
+    NF = (1 << 7),
+    VF = (1 << 6),
+    MF = (1 << 5),
+    XBF = (1 << 4),
+    DF = (1 << 3),
+    IF = (1 << 2),
+    ZF = (1 << 1),
+    CF = (1 << 0),
+};
+
+struct Opcode
+{
+    const char* name;
+    Mode mode;
+};
+
+Opcode opcodes[256];
+
+void Init()
+{
+    for (int i = 0; i < 256; i++)
+        opcodes[i] = {nullptr, Unknown};
+
+    opcodes[0x04] = {"tsb", Dir};
+    opcodes[0x08] = {"php", Imp};
+    opcodes[0x09] = {"ora", ImmM};
+    opcodes[0x0A] = {"asl", Imp};
+    opcodes[0x0B] = {"phd", Imp};
+    opcodes[0x10] = {"bpl", Rel};
+    opcodes[0x18] = {"clc", Imp};
+    opcodes[0x1A] = {"inc", Imp};
+    opcodes[0x1B] = {"tcs", Imp};
+    opcodes[0x20] = {"jsr", Abs};
+    opcodes[0x22] = {"jsl", Lng};
+    opcodes[0x26] = {"rol", Dir};
+    opcodes[0x28] = {"plp", Imp};
+    opcodes[0x29] = {"and", ImmM};
+    opcodes[0x2A] = {"rol", Imp};
+    opcodes[0x2B] = {"pld", Imp};
+    opcodes[0x2C] = {"bit", Abs};
+    opcodes[0x30] = {"bmi", Rel};
+    opcodes[0x38] = {"sec", Imp};
+    opcodes[0x3A] = {"dec", Imp};
+    opcodes[0x40] = {"rti", Imp};
+    opcodes[0x48] = {"pha", Imp};
+    opcodes[0x49] = {"eor", ImmM};
+    opcodes[0x4A] = {"lsr", Imp};
+    opcodes[0x4B] = {"phk", Imp};
+    opcodes[0x4C] = {"jmp", Abs};
+    opcodes[0x58] = {"cli", Imp};
+    opcodes[0x5A] = {"phy", Imp};
+    opcodes[0x5B] = {"tcd", Imp};
+    opcodes[0x5C] = {"jmp", Lng};
+    opcodes[0x60] = {"rts", Imp};
+    opcodes[0x64] = {"stz", Dir};
+    opcodes[0x65] = {"adc", Dir};
+    opcodes[0x67] = {"adc", DirLng8};
+    opcodes[0x68] = {"pla", Imp};
+    opcodes[0x69] = {"adc", ImmM};
+    opcodes[0x6A] = {"ror", Imp};
+    opcodes[0x6B] = {"rtl", Imp};
+    opcodes[0x6C] = {"jmp", AbsInd};
+    opcodes[0x74] = {"stz", DirX};
+    opcodes[0x78] = {"sei", Imp};
+    opcodes[0x7A] = {"ply", Imp};
+    opcodes[0x7B] = {"tdc", Imp};
+    opcodes[0x80] = {"bra", Rel};
+    opcodes[0x84] = {"sty", DirS};
+    opcodes[0x85] = {"sta", DirS};
+    opcodes[0x86] = {"stx", DirS};
+    opcodes[0x88] = {"dey", Imp};
+    opcodes[0x89] = {"bit", ImmM};
+    opcodes[0x8A] = {"txa", Imp};
+    opcodes[0x8B] = {"phb", Imp};
+    opcodes[0x8C] = {"sty", Abs};
+    opcodes[0x8D] = {"sta", Abs};
+    opcodes[0x8E] = {"stx", Abs};
+    opcodes[0x90] = {"bcc", Rel};
+    opcodes[0x92] = {"sta", DirLng8};
+    opcodes[0x98] = {"tya", Imp};
+    opcodes[0x99] = {"sta", AbsY};
+    opcodes[0x9B] = {"txy", Imp};
+    opcodes[0x9C] = {"stz", Abs};
+    opcodes[0x9D] = {"sta", AbsX};
+    opcodes[0x9E] = {"stz", AbsX};
+    opcodes[0xA0] = {"ldy", ImmX};
+    opcodes[0xA2] = {"ldx", ImmX};
+    opcodes[0xA4] = {"ldy", Dir};
+    opcodes[0xA5] = {"lda", Dir};
+    opcodes[0xA7] = {"lda", DirLng};
+    opcodes[0xA8] = {"tay", Imp};
+    opcodes[0xA9] = {"lda", ImmM};
+    opcodes[0xAA] = {"tax", Imp};
+    opcodes[0xAB] = {"plb", Imp};
+    opcodes[0xAD] = {"lda", Abs};
+    opcodes[0xAE] = {"ldx", Abs};
+    opcodes[0xB0] = {"bcs", Rel};
+    opcodes[0xB2] = {"lda", DirInd};
+    opcodes[0xB7] = {"lda", DirLngY};
+    opcodes[0xBB] = {"tyx", Imp};
+    opcodes[0xBD] = {"lda", AbsX};
+    opcodes[0xBF] = {"lda", LngX};
+    opcodes[0xC0] = {"cpy", ImmX};
+    opcodes[0xC2] = {"rep", ImmP};
+    opcodes[0xC4] = {"cpy", Dir};
+    opcodes[0xC6] = {"dec", Dir};
+    opcodes[0xC8] = {"iny", Imp};
+    opcodes[0xC9] = {"cmp", ImmM};
+    opcodes[0xCA] = {"dex", Imp};
+    opcodes[0xCB] = {"wai", Imp};
+    opcodes[0xCD] = {"cmp", Abs};
+    opcodes[0xD0] = {"bne", Rel};
+    opcodes[0xD8] = {"cld", Imp};
+    opcodes[0xDA] = {"phx", Imp};
+    opcodes[0xE0] = {"cpx", ImmX};
+    opcodes[0xE2] = {"sep", ImmP};
+    opcodes[0xE5] = {"sbc", Dir};
+    opcodes[0xE6] = {"inc", Dir};
+    opcodes[0xE8] = {"inx", Imp};
+    opcodes[0xE9] = {"sbc", ImmM};
+    opcodes[0xEB] = {"xba", Imp};
+    opcodes[0xF0] = {"beq", Rel};
+    opcodes[0xF4] = {"pea", Imm16};
+    opcodes[0xFA] = {"plx", Imp};
+    opcodes[0xFB] = {"xce", Imp};
+    opcodes[0xFC] = {"jsr", AbsXInd};
+}
+
+bool Taken(const Trace::Record& r)
+{
+    switch (r.opcode)
+    {
+    case 0x10: return !(r.p & NF);
+    case 0x30: return r.p & NF;
+    case 0x80: return true;
+    case 0x90: return !(r.p & CF);
+    case 0xB0: return r.p & CF;
+    case 0xD0: return !(r.p & ZF);
+    case 0xF0: return r.p & ZF;
+    }
+    return false;
+}
+
+// Mirrors the disassembly each handler in cpu.cpp used to print
+void Disassemble(const Trace::Record& r, char* buf, size_t size)
+{
+    const Opcode& op = opcodes[r.opcode];
+    const uint8_t* o = r.operands;
+    uint16_t imm16 = o[0] | (o[1] << 8);
+    uint32_t imm24 = imm16 | (o[2] << 16);
+    uint8_t pbr = r.pc >> 16;
+
+    switch (op.mode)
+    {
+    case Imp:
+        snprintf(buf, size, "%s     ", op.name);
+        break;
+    case ImmM:
+        if (r.p & MF)
+            snprintf(buf, size, "%s #$%02x ", op.name, o[0]);
+        else
+            snprintf(buf, size, "%s #$%04x ", op.name, imm16);
+        break;
+    case ImmX:
+        if (r.p & XBF)
+            snprintf(buf, size, "%s #$%02x ", op.name, o[0]);
+        else
+            snprintf(buf, size, "%s #$%04x ", op.name, imm16);
+        break;
+    case ImmP:
+        snprintf(buf, size, "%s #$%x ", op.name, o[0]);
+        break;
+    case Imm16:
+        snprintf(buf, size, "%s #$%04x ", op.name, imm16);
+        break;
+    case Dir:
+        snprintf(buf, size, "%s $%02x   ", op.name, (uint16_t)(r.d + o[0]) - r.d);
+        break;
+    case DirS:
+        snprintf(buf, size, "%s $%02x ", op.name, (uint16_t)(r.d + o[0]) - r.d);
+        break;
+    case DirX:
+        snprintf(buf, size, "%s $%02x,x ", op.name, (uint16_t)(r.d + o[0] + (r.x & 0xff)) - r.d - (r.x & 0xff));
+        break;
+    case DirInd:
+        snprintf(buf, size, "%s ($%02x) ", op.name, (uint16_t)(r.d + o[0]) - r.d);
+        break;
+    case DirLng:
+        snprintf(buf, size, "%s [$%02x] ", op.name, (uint16_t)(r.d + o[0]) - r.d);
+        break;
+    case DirLng8:
+        snprintf(buf, size, "%s [$%02x] ", op.name, (uint8_t)(r.d + o[0]) - r.d);
+        break;
+    case DirLngY:
+        snprintf(buf, size, "%s [$%02x],y ", op.name, (uint16_t)(r.d + o[0]) - r.d);
+        break;
+    case Abs:
+        snprintf(buf, size, "%s $%04x ", op.name, imm16);
+        break;
+    case AbsX:
+        snprintf(buf, size, "%s $%04x,x ", op.name, (uint16_t)(imm16 + r.x) - r.x);
+        break;
+    case AbsY:
+        snprintf(buf, size, "%s $%04x,y ", op.name, (uint16_t)(imm16 + r.y) - r.y);
+        break;
+    case AbsInd:
+        snprintf(buf, size, "%s ($%04x) ", op.name, imm16);
+        break;
+    case AbsXInd:
+        snprintf(buf, size, "%s ($%04x,x) ", op.name, (uint16_t)(imm16 + r.x));
+        break;
+    case Lng:
+        snprintf(buf, size, "%s $%06x ", op.name, imm24);
+        break;
+    case LngX:
+        snprintf(buf, size, "%s $%06x,x ", op.name, imm24);
+        break;
+    case Rel:
+    {
+        uint16_t pc = r.pc + 2;
+        int8_t rel = o[0];
+        if (Taken(r))
+            snprintf(buf, size, "%s $%06x (t) ", op.name, pbr << 16 | (uint16_t)(pc + rel));
+        else
+            snprintf(buf, size, "%s $%06x (n) ", op.name, pbr << 16 | (pc + rel));
+        break;
+    }
+    case Unknown:
+        snprintf(buf, size, "Unknown opcode 0x%02x", r.opcode);
+        break;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = "trace.bin";
+    bool show_cycles = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-c"))
+            show_cycles = true;
+        else
+            name = argv[i];
+    }
+
+    std::ifstream file(name, std::ios::binary);
+    if (!file)
+    {
+        printf("Couldn't open %s\n", name);
+        return 1;
+    }
+
+    Trace::FileHeader hdr;
+    file.read((char*)&hdr, sizeof(hdr));
+    if (!file || memcmp(hdr.magic, "SNTR", 4) || hdr.version != Trace::Version)
+    {
+        printf("%s is not a trace file\n", name);
+        return 1;
+    }
+
+    std::vector<Trace::Record> records(hdr.count);
+    file.read((char*)records.data(), hdr.count * sizeof(Trace::Record));
+    records.resize(file.gcount() / sizeof(Trace::Record));
+
+    Init();
+
+    uint64_t cycles = 0;
+    char disasm[64];
+
+    for (auto& r : records)
+    {
+        Disassemble(r, disasm, sizeof(disasm));
+
+        if (!opcodes[r.opcode].name)
+        {
+            printf("0x%06x %s\n", r.pc, disasm);
+            continue;
+        }
+
+        printf("0x%06x %s\t\t\tA:%04x X:%04x Y:%04x S:%04x D:%04x DB:%02x %s%s%s%s%s%s%s%s ", r.pc, disasm,
+            r.a, r.x, r.y, r.s, r.d, r.dbr,
+            (r.p & NF) ? "N" : "n",
+            (r.p & VF) ? "V" : "v",
+            (r.p & MF) ? "M" : "m",
+            (r.p & XBF) ? "X" : "x",
+            (r.p & DF) ? "D" : "d",
+            (r.p & IF) ? "I" : "i",
+            (r.p & ZF) ? "Z" : "z",
+            (r.p & CF) ? "C" : "c");
+
+        cycles += r.cycles;
+        if (show_cycles)
+            printf("CYC:%llu", (unsigned long long)cycles);
+
+        printf("\n");
+    }
+
+    return 0;
+}